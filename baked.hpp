@@ -0,0 +1,150 @@
+#pragma once
+
+#include <array>
+#include <tuple>
+#include <utility>
+#include <optional>
+
+#include "owrt.hpp"
+
+#include "sphere.hpp"
+
+/*
+Scenes baked in at compile time:
+    - A `Description` is a `constexpr` list of materials and spheres, the spheres naming
+      their material by its place in the list
+    - `Scene` over it tests every sphere in a fold over their indices, each against a
+      `constexpr` `object::Sphere`, so the loop, the `std::visit` and the loads of the
+      object list are gone and the centers and radii are folded into the code
+    - Only worth it for small scenes, every sphere is tested by every ray
+    - Materials are added at run time, their handles are only read for the hit surface
+*/
+namespace baked
+{
+    using object::WorldLike;
+
+    template<WorldLike TWorld>
+    struct Sphere
+    {
+        typename TWorld::Loc center;
+        typename TWorld::Num radius;
+        uint32_t material;  // into the description's `materials`
+    };
+
+    template<class TMaterials, class TSpheres>
+    struct Description
+    {
+        TMaterials materials;   // a `std::tuple` of the world's materials
+        TSpheres spheres;       // a `std::array` of `Sphere`
+    };
+
+    template<WorldLike TWorld, auto const& Desc>
+    class Scene
+    {
+        public:
+            using World = TWorld;
+            using Num = typename World::Num;
+            using Ray = typename World::Ray;
+            using MatTables = typename World::MatTables;
+            using HitRec = object::HitRecord<World>;
+            using Query = object::HitQuery<World>;
+
+            static constexpr size_t size = Desc.spheres.size();
+
+            MatTables materials;
+
+        private:
+            std::array<dispatch::Handle, std::tuple_size_v<std::remove_cvref_t<decltype(Desc.materials)>>> _handles;
+
+            template<size_t I>
+            static constexpr object::Sphere<World> sphere { Desc.spheres[I].center, Desc.spheres[I].radius, {} };
+
+            static constexpr auto each(auto&& f) { return f(std::make_index_sequence<size> {}); }
+
+        public:
+            Scene()
+            {
+                std::apply([&](auto const&... m) {
+                    size_t i = 0;
+                    ((_handles[i++] = materials.add(m)), ...);
+                }, Desc.materials);
+            }
+
+            constexpr auto intersect(vmath::RaySegLike auto seg) const -> std::optional<Query>
+            {
+                std::optional<Query> closest;
+                each([&]<size_t... I>(std::index_sequence<I...>) {
+                    ([&] {
+                        if (auto q = sphere<I>.intersect(seg)) {
+                            closest = Query { q->t, I };
+                            seg.t_max = q->t;
+                        }
+                    }(), ...);
+                });
+                return closest;
+            }
+
+            constexpr auto occluded(vmath::RaySegLike auto seg) const -> bool
+            {
+                return each([&]<size_t... I>(std::index_sequence<I...>) { return (sphere<I>.occluded(seg) || ...); });
+            }
+
+            constexpr auto surface(Ray const& r, Query const& q) const -> HitRec
+            {
+                HitRec rec;
+                each([&]<size_t... I>(std::index_sequence<I...>) {
+                    (void)((q.prim == I && (rec = surface_of<I>(r, q), true)) || ...);
+                });
+                return rec;
+            }
+
+            constexpr auto hit(vmath::RaySegLike auto seg) const -> std::optional<HitRec>
+            {
+                if (auto q = intersect(seg); q)
+                    return surface(seg.ray, *q);
+                return std::nullopt;
+            }
+
+            constexpr auto bounds() const
+            {
+                vmath::Bounds3<Num> b;
+                each([&]<size_t... I>(std::index_sequence<I...>) { (b.merge(sphere<I>.bounds()), ...); });
+                return b;
+            }
+
+            // The same scene as a plain list, same objects in the same order with the same
+            // handles, for what walks the objects, like `light::LightBVH::build`.
+            auto list() const -> object::HittableList<World>
+            {
+                object::HittableList<World> result;
+                result.materials = materials;
+                each([&]<size_t... I>(std::index_sequence<I...>) {
+                    (result.template add<object::Sphere>({ sphere<I>.center, sphere<I>.radius, _handles[Desc.spheres[I].material] }), ...);
+                });
+                return result;
+            }
+
+        private:
+            template<size_t I>
+            constexpr auto surface_of(Ray const& r, Query const& q) const -> HitRec
+            {
+                auto rec = sphere<I>.surface(r, q);
+                rec.material = _handles[Desc.spheres[I].material];
+                return rec;
+            }
+    };
+
+    // Adds a description's materials and spheres to `world` in order, so the scene it
+    // describes goes through any other aggregate the same as through a `Scene`.
+    template<class TList>
+    void add_to(TList& world, auto const& desc)
+    {
+        std::array<dispatch::Handle, std::tuple_size_v<std::remove_cvref_t<decltype(desc.materials)>>> handles;
+        std::apply([&](auto const&... m) {
+            size_t i = 0;
+            ((handles[i++] = world.materials.add(m)), ...);
+        }, desc.materials);
+        for (auto const& s : desc.spheres)
+            world.template add<object::Sphere>({ s.center, s.radius, handles[s.material] });
+    }
+}
@@ -0,0 +1,285 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include <variant>
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <string_view>
+
+#include "owrt.hpp"
+
+#include "bvh.hpp"
+#include "grid.hpp"
+#include "wide.hpp"
+#include "golden.hpp"
+#include "scenes.hpp"
+#include "generate.hpp"
+
+/*
+Acceleration structure benchmark:
+    Builds each scene into every aggregate and reports the time to build it, the memory
+    its acceleration structure takes and the time to render a small image through it.
+    Renders are compared pixel by pixel against the first aggregate's, since all of them
+    have to find the same hits. The plain list sits out scenes where it would take minutes.
+*/
+namespace bench
+{
+    constexpr char const* scenes[] = { "random_scene", "random_scene_large", "many_lamps", "instances" };
+
+    constexpr int width = 160, height = 90, samples = 4, max_depth = 8;
+    constexpr size_t max_list_objects = 1000;
+
+    template<dispatch::WorldLike TWorld>
+    auto build_scene(std::string_view name, object::HittableList<TWorld>& world)
+    {
+        auto aspect_ratio = typename TWorld::Num(width) / height;
+        if (name == "random_scene") return scenes::random_scene(world, aspect_ratio, 11);
+        if (name == "random_scene_large") return scenes::random_scene(world, aspect_ratio, 40);
+        if (name == "many_lamps") return scenes::many_lamps(world, aspect_ratio);
+        return scenes::instances(world, aspect_ratio);
+    }
+
+    template<dispatch::WorldLike TWorld, class TAggregate>
+    void measure(auto& scheduler, char const* scene_name, char const* label, auto&& configure,
+        std::vector<typename TWorld::Color>& reference)
+    {
+        using clock = std::chrono::steady_clock;
+
+        TAggregate world;
+        configure(world);
+        auto cam = build_scene(scene_name, world);
+        if (std::same_as<TAggregate, object::HittableList<TWorld>> && world.objects.size() > max_list_objects)
+            return;
+
+        auto start = clock::now();
+        if constexpr (requires { world.build(); })
+            world.build();
+        auto build_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+        size_t bytes = 0;
+        if constexpr (requires { world.accel.bytes(); })
+            bytes = world.accel.bytes();
+
+        auto lights = light::LightBVH<TWorld>::build(world);
+        render::Scene scene { world, lights };
+        golden::Case c { scene_name, width, height, samples, samples, max_depth };
+
+        start = clock::now();
+        auto image = golden::accumulate_case<TWorld>(scheduler, c, scene, cam);
+        auto seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+        if (reference.empty()) reference = image;
+        size_t differ = 0;
+        for (size_t p = 0; p < image.size(); ++p)
+            differ += image[p] != reference[p];
+
+        std::cerr << std::left << std::setw(20) << scene_name << std::setw(8) << label << std::right
+            << std::setw(9) << world.objects.size()
+            << std::setw(10) << std::fixed << std::setprecision(2) << build_ms
+            << std::setw(10) << std::setprecision(1) << bytes / 1024.0
+            << std::setw(10) << std::setprecision(3) << seconds
+            << std::setw(8) << differ << std::defaultfloat << "\n";
+    }
+
+    template<dispatch::WorldLike TWorld>
+    void run(auto& scheduler)
+    {
+        std::cerr << std::left << std::setw(20) << "scene" << std::setw(8) << "accel" << std::right
+            << std::setw(9) << "objects" << std::setw(10) << "build ms" << std::setw(10) << "accel KB"
+            << std::setw(10) << "render s"
+            << std::setw(8) << "differ" << "\n";
+
+        for (auto name : scenes)
+        {
+            std::vector<typename TWorld::Color> reference;
+            auto none = [](auto&) { };
+            measure<TWorld, object::HittableList<TWorld>>(scheduler, name, "list", none, reference);
+            measure<TWorld, object::BvhList<TWorld>>(scheduler, name, "bvh", none, reference);
+            measure<TWorld, object::WideBvhList<TWorld>>(scheduler, name, "wide", none, reference);
+            measure<TWorld, object::GridList<TWorld>>(scheduler, name, "grid", none, reference);
+            measure<TWorld, object::GridList<TWorld>>(scheduler, name, "grid2", [](auto& w) { w.settings.two_level = true; }, reference);
+        }
+    }
+
+    /*
+    Animation benchmark:
+        Moves the spheres of the large random scene a little every frame, one in sixteen
+        drifting off for good, and follows them with `refit`. Every frame is also built
+        from scratch, to compare the setup times and check both render the same image.
+    */
+    template<dispatch::WorldLike TWorld>
+    void animate(auto& scheduler, int frames = 8)
+    {
+        using clock = std::chrono::steady_clock;
+        using Num = typename TWorld::Num;
+        using Sphere = object::Sphere<TWorld>;
+        auto ms_since = [](auto start) { return std::chrono::duration<double, std::milli>(clock::now() - start).count(); };
+
+        object::BvhList<TWorld> world;
+        auto cam = build_scene("random_scene_large", world);
+        world.build();
+
+        std::vector<typename TWorld::Loc> rest;
+        for (auto const& o : world.objects) rest.push_back(std::get<Sphere>(o).center);
+
+        auto render = [&](auto const& w) {
+            auto lights = light::LightBVH<TWorld>::build(w);
+            render::Scene scene { w, lights };
+            golden::Case c { "animate", width, height, samples, samples, max_depth };
+            auto start = clock::now();
+            auto image = golden::accumulate_case<TWorld>(scheduler, c, scene, cam);
+            return std::pair { image, std::chrono::duration<double>(clock::now() - start).count() };
+        };
+
+        std::cerr << std::setw(6) << "frame" << std::setw(10) << "refit ms" << std::setw(10) << "subtrees"
+            << std::setw(9) << "prims" << std::setw(10) << "build ms" << std::setw(10) << "render s"
+            << std::setw(10) << "built s" << std::setw(8) << "differ" << "\n";
+
+        for (int frame = 1; frame <= frames; ++frame)
+        {
+            for (size_t i = 0; i < world.objects.size(); ++i)
+            {
+                auto& sphere = std::get<Sphere>(world.objects[i]);
+                if (sphere.radius > 100) continue;  // the ground
+                auto p = rest[i];
+                p.y += Num(0.15) * std::sin(Num(0.8) * frame + Num(i));
+                if (i % 16 == 0) {
+                    p.x += Num(0.6) * frame * (Num(i / 16 % 3) - 1);
+                    p.y += Num(0.4) * frame;
+                }
+                sphere.center = p;
+            }
+
+            auto start = clock::now();
+            auto refit = world.refit(scheduler);
+            auto refit_ms = ms_since(start);
+
+            auto built = world;
+            start = clock::now();
+            built.build();
+            auto build_ms = ms_since(start);
+
+            auto [image, seconds] = render(world);
+            auto [reference, built_seconds] = render(built);
+            size_t differ = 0;
+            for (size_t p = 0; p < image.size(); ++p)
+                differ += image[p] != reference[p];
+
+            std::cerr << std::setw(6) << frame << std::fixed
+                << std::setw(10) << std::setprecision(2) << refit_ms
+                << std::setw(10) << refit.subtrees
+                << std::setw(9) << refit.primitives
+                << std::setw(10) << std::setprecision(2) << build_ms
+                << std::setw(10) << std::setprecision(3) << seconds
+                << std::setw(10) << std::setprecision(3) << built_seconds
+                << std::setw(8) << differ << std::defaultfloat << "\n";
+        }
+    }
+
+    /*
+    Thumbnail benchmark:
+        Renders a batch of small images of `five_spheres`, each with its own seed, through
+        the plain list, the BVH and the scene baked at compile time, and compares every
+        image against the list's. Shading dominates a render, so the closest hits of one
+        thumbnail's camera rays are also timed alone, on one thread, and checked likewise.
+    */
+    template<dispatch::WorldLike TWorld>
+    void thumbnails(auto& scheduler, int count = 64)
+    {
+        using clock = std::chrono::steady_clock;
+        using Num = typename TWorld::Num;
+
+        constexpr int thumb_width = 96, thumb_height = 54, thumb_samples = 8;
+        golden::Case c { "thumbnails", thumb_width, thumb_height, thumb_samples, thumb_samples, max_depth };
+        auto cam = scenes::five_spheres_camera<TWorld>(Num(thumb_width) / thumb_height);
+
+        // the camera rays of one thumbnail, every sample of every pixel
+        std::vector<typename TWorld::Ray> rays;
+        rays.reserve(size_t(thumb_width) * thumb_height * thumb_samples);
+        for (int j = 0; j < thumb_height; ++j)
+            for (int i = 0; i < thumb_width; ++i)
+                for (int k = 0; k < thumb_samples; ++k)
+                {
+                    auto rs = sampler::Independent::for_sample(0, i, j, k);
+                    auto [du, dv] = sampler::get2d<Num>(rs);
+                    rays.push_back(cam.get_ray(Num(i + du) / (thumb_width - 1), Num(j + dv) / (thumb_height - 1), rs));
+                }
+
+        std::vector<std::vector<typename TWorld::Color>> reference;
+        std::vector<uint32_t> reference_hits;
+        auto measure = [&](char const* label, auto const& world, auto const& lights) {
+            render::Scene scene { world, lights };
+            size_t differ = 0;
+            auto start = clock::now();
+            for (int i = 0; i < count; ++i)
+            {
+                auto image = golden::accumulate_case<TWorld>(scheduler, c, scene, cam, uint64_t(i));
+                if (reference.size() <= size_t(i)) reference.push_back(image);
+                for (size_t p = 0; p < image.size(); ++p)
+                    differ += image[p] != reference[i][p];
+            }
+            auto ms = std::chrono::duration<double, std::milli>(clock::now() - start).count() / count;
+
+            // the primitive each ray hits first, `UINT32_MAX` for none
+            std::vector<uint32_t> hits(rays.size());
+            start = clock::now();
+            for (int i = 0; i < count; ++i)
+                for (size_t r = 0; r < rays.size(); ++r) {
+                    auto q = world.intersect(rays[r].span(0, common::infinity));
+                    hits[r] = q ? uint32_t(q->prim) : UINT32_MAX;
+                }
+            auto ns = std::chrono::duration<double, std::nano>(clock::now() - start).count() / (double(count) * rays.size());
+            if (reference_hits.empty()) reference_hits = hits;
+            size_t hits_differ = 0;
+            for (size_t r = 0; r < rays.size(); ++r)
+                hits_differ += hits[r] != reference_hits[r];
+
+            std::cerr << std::left << std::setw(8) << label << std::right << std::fixed
+                << std::setw(12) << std::setprecision(3) << ms
+                << std::setw(8) << differ
+                << std::setw(10) << std::setprecision(2) << ns
+                << std::setw(8) << hits_differ << std::defaultfloat << "\n";
+        };
+
+        std::cerr << std::left << std::setw(8) << "accel" << std::right
+            << std::setw(12) << "ms / image" << std::setw(8) << "differ"
+            << std::setw(10) << "ns / ray" << std::setw(8) << "differ" << "\n";
+
+        object::HittableList<TWorld> list;
+        scenes::five_spheres(list, Num(1));
+        measure("list", list, light::LightBVH<TWorld>::build(list));
+
+        object::BvhList<TWorld> bvh;
+        scenes::five_spheres(bvh, Num(1));
+        bvh.build();
+        measure("bvh", bvh, light::LightBVH<TWorld>::build(bvh));
+
+        baked::Scene<TWorld, scenes::five_spheres_baked<TWorld>> baked;
+        measure("baked", baked, light::LightBVH<TWorld>::build(baked.list()));
+    }
+
+    // Memory of `world`'s objects, materials and acceleration structure, in all and per object.
+    template<class TList>
+    void footprint(TList const& world)
+    {
+        auto const count = std::max<size_t>(world.objects.size(), 1);
+        size_t accel = 0;
+        if constexpr (requires { world.accel.bytes(); })
+            accel = world.accel.bytes();
+
+        std::pair<char const*, size_t> const rows[] = {
+            { "objects", world.object_bytes() },
+            { "materials", world.materials.bytes() },
+            { "accel", accel },
+            { "total", world.object_bytes() + world.materials.bytes() + accel },
+        };
+        std::cerr << std::left << std::setw(12) << "memory" << std::right
+            << std::setw(12) << "KB" << std::setw(12) << "B / object" << "\n";
+        for (auto [name, bytes] : rows)
+            std::cerr << std::left << std::setw(12) << name << std::right << std::fixed
+                << std::setw(12) << std::setprecision(1) << bytes / 1024.0
+                << std::setw(12) << std::setprecision(2) << double(bytes) / count << std::defaultfloat << "\n";
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <limits>
+#include <algorithm>
+
+#include "vmath.hpp"
+
+namespace vmath
+{
+    template<class TNum = double>
+    struct Bounds3
+    {
+        using Num = TNum;
+        using Self = Bounds3<Num>;
+        using Loc = Loc3<Num>;
+        using Vec = Vec3<Num>;
+
+        static constexpr Num Inf = std::numeric_limits<Num>::infinity();
+
+        // empty by default, so anything merged into it replaces it
+        Loc lo { Inf, Inf, Inf };
+        Loc hi { -Inf, -Inf, -Inf };
+
+        static constexpr auto around(Loc const& center, Num radius)
+        {
+            auto r = std::abs(radius);
+            return Self { center - Vec { r, r, r }, center + Vec { r, r, r } };
+        }
+
+        constexpr auto empty() const { return lo.x > hi.x || lo.y > hi.y || lo.z > hi.z; }
+
+        constexpr auto diagonal() const { return hi - lo; }
+        constexpr auto centroid() const { return lo + Num(0.5) * diagonal(); }
+
+        constexpr auto surface_area() const
+        {
+            if (empty()) return Num(0);
+            auto [dx, dy, dz] = diagonal();
+            return 2 * (dx * dy + dy * dz + dz * dx);
+        }
+
+        // Index of the longest axis.
+        constexpr auto major_axis() const
+        {
+            auto [dx, dy, dz] = diagonal();
+            return dx > dy && dx > dz ? 0 : dy > dz ? 1 : 2;
+        }
+
+        constexpr auto contains(Loc const& p) const
+        {
+            return p.x >= lo.x && p.x <= hi.x
+                && p.y >= lo.y && p.y <= hi.y
+                && p.z >= lo.z && p.z <= hi.z;
+        }
+
+        // Position of `p` within the box, 0 at `lo` and 1 at `hi` along each axis.
+        constexpr auto offset(Loc const& p) const
+        {
+            auto o = p - lo;
+            auto d = diagonal();
+            return Vec {
+                d.x > 0 ? o.x / d.x : Num(0),
+                d.y > 0 ? o.y / d.y : Num(0),
+                d.z > 0 ? o.z / d.z : Num(0),
+            };
+        }
+
+        constexpr auto& merge(Loc const& p)
+        {
+            lo = Loc { std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z) };
+            hi = Loc { std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z) };
+            return *this;
+        }
+
+        constexpr auto& merge(Self const& b)
+        {
+            if (b.empty()) return *this;
+            return merge(b.lo).merge(b.hi);
+        }
+    };
+
+    template<class TNum>
+    constexpr auto merge(Bounds3<TNum> a, Bounds3<TNum> const& b) { return a.merge(b); }
+}
@@ -1,2 +1,2 @@
 
-g++ -Wall -fconcepts-diagnostics-depth=3 -g -O3 -march=native -std=c++23 main.cpp -o rt
+g++ -Wall -fconcepts-diagnostics-depth=3 -g -O3 -fno-math-errno -march=native -std=c++23 main.cpp -o rt
@@ -0,0 +1,497 @@
+#pragma once
+
+#include <span>
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <ranges>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+
+#include "owrt.hpp"
+
+#include "bounds.hpp"
+#include "memory.hpp"
+
+/*
+Bounding volume hierarchy over primitives given by their boxes:
+    - Binary, split with the surface area heuristic over centroid buckets
+    - Nodes are laid out depth first, the first child follows its parent and
+      only the second child's index is stored
+    - Leaves hold runs of `order`, the primitive ids rearranged so every leaf's
+      primitives are contiguous
+    - Traversal takes a callback that tests a primitive, so the same hierarchy
+      serves any primitive type
+    - Moving primitives are followed by `refit`, which keeps the tree and only recomputes
+      the boxes; where that has made a subtree's SAH cost grow too far, the subtree is
+      built again in place
+    - The items a build sorts live in the thread's `memory::scratch` arena
+*/
+namespace bvh
+{
+    struct Settings
+    {
+        uint32_t max_leaf = 4;          // primitives a leaf holds before the SAH is asked at all
+        uint32_t max_sah_leaf = 16;     // larger leaves are split even when SAH says not to
+        float rebuild_ratio = 1.15;     // growth in a subtree's SAH cost `refit` puts up with before building it again
+    };
+
+    template<std::floating_point TNum>
+    class Bvh
+    {
+        public:
+            using Num = TNum;
+            using Bounds = vmath::Bounds3<Num>;
+            using Settings = bvh::Settings;
+
+            struct Node
+            {
+                Bounds bounds;
+                uint32_t index = 0; // first entry of `order` for a leaf, the second child otherwise
+                uint16_t count = 0; // primitives of a leaf, zero for an interior node
+                uint8_t axis = 0;   // the children were split along, to visit the near one first
+            };
+
+            static constexpr int bucket_count = 12;
+            static constexpr int max_depth = 64;        // of interior nodes on a path, the traversal stack's size
+            static constexpr int parallel_depth = 6;    // `refit` hands out the subtrees below this depth
+            static constexpr size_t parallel_nodes = size_t(1) << 16;  // to trees of at least this many nodes
+
+            struct Refit
+            {
+                uint32_t subtrees = 0;      // built again
+                uint32_t primitives = 0;    // under those subtrees
+            };
+
+        private:
+            Settings _settings;
+            std::vector<Node> _nodes;
+            std::vector<uint32_t> _order;
+            std::vector<Num> _cost;         // per node SAH cost of its subtree, only kept once `refit` is used
+            std::vector<Num> _baseline;     // per node `relative_cost` when it was built
+
+        public:
+            Bvh() = default;
+
+            explicit Bvh(std::span<Bounds const> prims, Settings const& settings = {})
+                : _settings { settings }
+            {
+                if (std::max(settings.max_leaf, settings.max_sah_leaf) > UINT16_MAX) throw std::invalid_argument("bvh leaves hold at most 65535 primitives");
+                if (prims.empty()) return;
+
+                memory::Rewind scratch;
+                auto items = scratch.vector<Item>(prims.size());
+                for (uint32_t i = 0; i < prims.size(); ++i)
+                    items[i] = { prims[i], prims[i].centroid(), i };
+
+                _nodes.reserve(2 * prims.size());
+                build(_nodes, items, 0, uint32_t(items.size()));
+
+                _order.reserve(items.size());
+                for (auto const& item : items) _order.push_back(item.prim);
+            }
+
+            // A hierarchy built earlier, from its `nodes` and `order`, throwing `std::invalid_argument`
+            // when they do not form one over `order.size()` primitives no deeper than `max_depth`.
+            static auto adopt(std::span<Node const> nodes, std::span<uint32_t const> order, Settings const& settings = {}) -> Bvh
+            {
+                for (uint32_t i = 0; i < nodes.size(); ++i) {
+                    auto const& n = nodes[i];
+                    bool fits = n.count > 0
+                        ? size_t(n.index) + n.count <= order.size()
+                        : i + 1 < nodes.size() && n.index > i + 1 && n.index < nodes.size() && n.axis < 3;
+                    if (!fits) throw std::invalid_argument("bvh node out of range");
+                }
+
+                // children come after their parents, so a node's depth is final when it is reached
+                std::vector<uint8_t> depth(nodes.size());
+                for (uint32_t i = 0; i < nodes.size(); ++i) {
+                    if (nodes[i].count > 0) continue;
+                    if (depth[i] + 1 > max_depth) throw std::invalid_argument("bvh deeper than its traversal stack");
+                    for (auto child : { i + 1, nodes[i].index })
+                        depth[child] = std::max(depth[child], uint8_t(depth[i] + 1));
+                }
+                if (std::ranges::any_of(order, [&](uint32_t p) { return p >= order.size(); }))
+                    throw std::invalid_argument("bvh primitive out of range");
+
+                Bvh bvh;
+                bvh._settings = settings;
+                bvh._nodes.assign(nodes.begin(), nodes.end());
+                bvh._order.assign(order.begin(), order.end());
+                return bvh;
+            }
+
+            auto nodes() const -> std::span<Node const> { return _nodes; }
+            auto order() const -> std::span<uint32_t const> { return _order; }
+            auto bounds() const -> Bounds { return _nodes.empty() ? Bounds {} : _nodes[0].bounds; }
+            auto bytes() const -> size_t
+            {
+                return _nodes.size() * sizeof(Node) + _order.size() * sizeof(uint32_t) + (_cost.size() + _baseline.size()) * sizeof(Num);
+            }
+
+            // Closest hit along `seg`. `test(prim, seg)` returns an optional with a `t` member,
+            // and the segment is cut short at every hit so farther boxes are skipped.
+            auto intersect(vmath::RaySegLike auto seg, auto&& test) const -> decltype(test(uint32_t(), seg))
+            {
+                decltype(test(uint32_t(), seg)) closest;
+                traverse(seg, [&](uint32_t prim, auto& s) {
+                    if (auto q = test(prim, s)) {
+                        closest = q;
+                        s.t_max = q->t;
+                    }
+                    return false;
+                });
+                return closest;
+            }
+
+            // Whether `test(prim, seg)` holds for any primitive, stopping at the first.
+            auto occluded(vmath::RaySegLike auto seg, auto&& test) const -> bool
+            {
+                return traverse(seg, [&](uint32_t prim, auto const& s) { return bool(test(prim, s)); });
+            }
+
+            /*
+            Follows primitives that moved, `prims` being the boxes of the same primitives the tree
+            was built over:
+                - Node boxes are recomputed bottom up, the subtrees below `parallel_depth` run on
+                  `scheduler` since each is a contiguous run of nodes; trees smaller than
+                  `parallel_nodes` are done on the calling thread, where handing out the work
+                  would cost more than the work
+                - The topmost subtrees whose `relative_cost` has grown past `rebuild_ratio` times
+                  what it was when they were built are built again; the rest keep their reference,
+                  so slow degradation still adds up. Only the new nodes and their ancestors have
+                  their cost updated, and a degraded root is a plain build
+            */
+            auto refit(std::span<Bounds const> prims, auto& scheduler) -> Refit
+            {
+                if (prims.size() != _order.size()) throw std::invalid_argument("bvh refit with a different primitive count");
+                if (_nodes.empty()) return {};
+
+                if (_baseline.empty()) reset_baseline(scheduler);
+
+                bottom_up(scheduler, [&](uint32_t node) {
+                    auto& n = _nodes[node];
+                    if (n.count > 0) {
+                        n.bounds = {};
+                        for (auto i = n.index; i < n.index + n.count; ++i) n.bounds.merge(prims[_order[i]]);
+                    } else {
+                        n.bounds = _nodes[node + 1].bounds;
+                        n.bounds.merge(_nodes[n.index].bounds);
+                    }
+                    update_cost(node);
+                });
+
+                std::vector<uint32_t> subtrees;
+                degraded(0, subtrees);
+                if (subtrees.empty()) return {};
+
+                if (subtrees.front() == 0) {
+                    *this = Bvh(prims, _settings);
+                    reset_baseline(scheduler);
+                    return { 1, uint32_t(prims.size()) };
+                }
+                return { uint32_t(subtrees.size()), rebuild(prims, subtrees) };
+            }
+
+        private:
+            struct Item
+            {
+                Bounds bounds;
+                vmath::Loc3<Num> centroid;
+                uint32_t prim;
+            };
+
+            // Builds the node over `items[begin, end)` onto `nodes`, returning its index.
+            auto build(std::vector<Node>& nodes, std::span<Item> items, uint32_t begin, uint32_t end) -> uint32_t
+            {
+                auto node = uint32_t(nodes.size());
+                nodes.emplace_back();
+
+                Bounds all, centroids;
+                for (auto i = begin; i < end; ++i) {
+                    all.merge(items[i].bounds);
+                    centroids.merge(items[i].centroid);
+                }
+                nodes[node].bounds = all;
+
+                auto axis = centroids.major_axis();
+                auto mid = end - begin > _settings.max_leaf ? split(items.begin() + begin, items.begin() + end, axis, all, centroids) : 0;
+                if (mid == 0) {
+                    nodes[node].index = begin;
+                    nodes[node].count = uint16_t(end - begin);
+                    return node;
+                }
+
+                build(nodes, items, begin, begin + mid);
+                auto second = build(nodes, items, begin + mid, end);
+                nodes[node].index = second;
+                nodes[node].axis = uint8_t(axis);
+                return node;
+            }
+
+            // One past the last node of the subtree at `node`.
+            auto subtree_end(uint32_t node) const -> uint32_t
+            {
+                while (_nodes[node].count == 0) node = _nodes[node].index;
+                return node + 1;
+            }
+
+            // Calls `f(node)` on every node, children before their parent.
+            void bottom_up(auto& scheduler, auto&& f)
+            {
+                if (_nodes.size() < parallel_nodes) {
+                    // children come after their parent, so backwards is bottom up
+                    for (auto node = uint32_t(_nodes.size()); node-- > 0;) f(node);
+                    return;
+                }
+
+                std::vector<uint32_t> top, subtrees;
+                std::vector<std::pair<uint32_t, int>> pending { { 0, 0 } };
+                while (!pending.empty())
+                {
+                    auto [node, depth] = pending.back();
+                    pending.pop_back();
+                    if (_nodes[node].count > 0 || depth == parallel_depth) {
+                        subtrees.push_back(node);
+                        continue;
+                    }
+                    top.push_back(node);
+                    pending.push_back({ node + 1, depth + 1 });
+                    pending.push_back({ _nodes[node].index, depth + 1 });
+                }
+
+                for (auto root : subtrees)
+                    scheduler.schedule([this, &f, root](auto&) {
+                        for (auto node = subtree_end(root); node-- > root;) f(node);
+                    });
+                scheduler.flush();
+                // `top` has parents before children
+                for (auto node : top | std::views::reverse) f(node);
+            }
+
+            // The costs of the tree as it is now, and those as the baselines to refit against.
+            void reset_baseline(auto& scheduler)
+            {
+                _cost.resize(_nodes.size());
+                bottom_up(scheduler, [&](uint32_t node) { update_cost(node); });
+                _baseline.resize(_nodes.size());
+                for (uint32_t node = 0; node < _nodes.size(); ++node) _baseline[node] = relative_cost(node);
+            }
+
+            void update_cost(uint32_t node)
+            {
+                auto const& n = _nodes[node];
+                auto area = n.bounds.surface_area();
+                _cost[node] = n.count > 0 ? area * n.count : Num(0.5) * area + _cost[node + 1] + _cost[n.index];
+            }
+
+            // The SAH cost of a subtree for a ray that enters its box: how well the subtree is
+            // built whatever the size of the box, which moving primitives also change.
+            auto relative_cost(uint32_t node) const -> Num
+            {
+                auto area = _nodes[node].bounds.surface_area();
+                return area > 0 ? _cost[node] / area : Num(0);
+            }
+
+            // The topmost subtrees below `node` to build again, in layout order.
+            void degraded(uint32_t node, std::vector<uint32_t>& subtrees) const
+            {
+                auto const& n = _nodes[node];
+                if (n.count > 0) return;
+                if (relative_cost(node) > _settings.rebuild_ratio * _baseline[node]) {
+                    subtrees.push_back(node);
+                    return;
+                }
+                degraded(node + 1, subtrees);
+                degraded(n.index, subtrees);
+            }
+
+            // Lays the tree out again with `subtrees` built anew over their own primitives,
+            // returning how many primitives that took. Costs and baselines move along with
+            // their nodes; the new nodes get both, and their ancestors a new cost.
+            auto rebuild(std::span<Bounds const> prims, std::span<uint32_t const> subtrees) -> uint32_t
+            {
+                Layout layout { prims, subtrees };
+                layout.nodes.reserve(_nodes.size());
+                layout.cost.reserve(_nodes.size());
+                layout.baseline.reserve(_nodes.size());
+                relayout(layout, 0);
+                _nodes = std::move(layout.nodes);
+                _cost = std::move(layout.cost);
+                _baseline = std::move(layout.baseline);
+
+                for (auto node : layout.changed) {
+                    update_cost(node);
+                    if (_baseline[node] < 0) _baseline[node] = relative_cost(node);
+                }
+                return layout.rebuilt;
+            }
+
+            struct Layout
+            {
+                std::span<Bounds const> prims;
+                std::span<uint32_t const> subtrees;     // still to come, in layout order
+                std::vector<Node> nodes;
+                std::vector<Num> cost;
+                std::vector<Num> baseline;
+                std::vector<uint32_t> changed;          // nodes whose cost is stale, children first
+                uint32_t rebuilt = 0;
+            };
+
+            // Copies the subtree at `node` onto the layout, building it again when it is the
+            // next of `subtrees`, and returns where it went.
+            auto relayout(Layout& out, uint32_t node) -> uint32_t
+            {
+                auto at = uint32_t(out.nodes.size());
+                if (!out.subtrees.empty() && out.subtrees.front() == node) {
+                    out.subtrees = out.subtrees.subspan(1);
+
+                    // its primitives are the run of `order` from its first leaf to its last
+                    auto first = node;
+                    while (_nodes[first].count == 0) ++first;
+                    auto const& last = _nodes[subtree_end(node) - 1];
+                    auto begin = _nodes[first].index, count = last.index + last.count - begin;
+
+                    memory::Rewind scratch;
+                    auto items = scratch.vector<Item>(count);
+                    for (uint32_t i = 0; i < count; ++i) {
+                        auto prim = _order[begin + i];
+                        items[i] = { out.prims[prim], out.prims[prim].centroid(), prim };
+                    }
+                    build(out.nodes, items, 0, count);
+                    out.rebuilt += count;
+                    for (uint32_t i = 0; i < count; ++i) _order[begin + i] = items[i].prim;
+                    for (auto i = at; i < out.nodes.size(); ++i)
+                        if (out.nodes[i].count > 0) out.nodes[i].index += begin;
+                    out.cost.resize(out.nodes.size());
+                    out.baseline.resize(out.nodes.size(), Num(-1));
+                    for (auto i = uint32_t(out.nodes.size()); i-- > at;) out.changed.push_back(i);
+                    return at;
+                }
+
+                out.nodes.push_back(_nodes[node]);
+                out.cost.push_back(_cost[node]);
+                out.baseline.push_back(_baseline[node]);
+                if (_nodes[node].count == 0) {
+                    auto before = out.rebuilt;
+                    relayout(out, node + 1);
+                    out.nodes[at].index = relayout(out, _nodes[node].index);
+                    if (out.rebuilt != before) out.changed.push_back(at);
+                }
+                return at;
+            }
+
+            // How many items go to the first child by bucketed SAH, or 0 when a leaf is cheaper.
+            auto split(auto begin, auto end, int axis, Bounds const& all, Bounds const& centroids) -> uint32_t
+            {
+                auto const count = uint32_t(end - begin);
+                auto lo = centroids.lo[axis], extent = centroids.hi[axis] - lo;
+                if (!(extent > 0)) {
+                    // all centroids in one place, only worth splitting to keep leaves small
+                    if (count <= _settings.max_sah_leaf) return 0;
+                    return count / 2;
+                }
+
+                auto bucket_of = [&](Item const& item) {
+                    auto b = int(bucket_count * ((item.centroid[axis] - lo) / extent));
+                    return std::clamp(b, 0, bucket_count - 1);
+                };
+
+                std::array<Bounds, bucket_count> bounds;
+                std::array<uint32_t, bucket_count> counts {};
+                for (auto it = begin; it != end; ++it) {
+                    auto b = bucket_of(*it);
+                    bounds[b].merge(it->bounds);
+                    ++counts[b];
+                }
+
+                // cost of splitting after each bucket, in units of primitive tests
+                std::array<Num, bucket_count - 1> cost {};
+                Bounds below;
+                uint32_t below_count = 0;
+                for (int b = 0; b < bucket_count - 1; ++b) {
+                    below.merge(bounds[b]);
+                    below_count += counts[b];
+                    cost[b] = below_count * below.surface_area();
+                }
+                Bounds above;
+                uint32_t above_count = 0;
+                for (int b = bucket_count - 1; b > 0; --b) {
+                    above.merge(bounds[b]);
+                    above_count += counts[b];
+                    cost[b - 1] += above_count * above.surface_area();
+                }
+
+                auto best = int(std::ranges::min_element(cost) - cost.begin());
+                auto area = all.surface_area();
+                auto split_cost = Num(0.5) + (area > 0 ? cost[best] / area : Num(0));
+                if (count <= _settings.max_sah_leaf && split_cost >= Num(count))
+                    return 0;
+
+                auto mid = std::partition(begin, end, [&](Item const& item) { return bucket_of(item) <= best; });
+                return uint32_t(mid - begin);
+            }
+
+            // `visit(prim, seg)` sees candidates nearest box first and may shrink `seg.t_max`,
+            // returning true ends the traversal.
+            auto traverse(auto seg, auto&& visit) const -> bool
+            {
+                if (_nodes.empty()) return false;
+
+                using RNum = typename decltype(seg)::Num;
+                auto const& r = seg.ray;
+                vmath::Vec3<RNum> inv { 1 / r.direction.x, 1 / r.direction.y, 1 / r.direction.z };
+                std::array<bool, 3> negative { inv.x < 0, inv.y < 0, inv.z < 0 };
+
+                // Slabs of the box, widened by the rounding error of the far distances so a ray
+                // grazing a box edge is not lost between two boxes.
+                auto crosses = [&](Bounds const& b) {
+                    auto t0 = seg.t_min, t1 = seg.t_max;
+                    for (int a = 0; a < 3; ++a) {
+                        auto near = (RNum(negative[a] ? b.hi[a] : b.lo[a]) - r.origin[a]) * inv[a];
+                        auto far = (RNum(negative[a] ? b.lo[a] : b.hi[a]) - r.origin[a]) * inv[a];
+                        far *= 1 + 2 * common::gamma<RNum>(3);
+                        t0 = near > t0 ? near : t0;
+                        t1 = far < t1 ? far : t1;
+                        if (t0 > t1) return false;
+                    }
+                    return true;
+                };
+
+                std::array<uint32_t, max_depth> stack;
+                size_t top = 0;
+                uint32_t node = 0;
+                while (true)
+                {
+                    auto const& n = _nodes[node];
+                    if (crosses(n.bounds)) {
+                        if (n.count > 0) {
+                            for (auto i = n.index; i < n.index + n.count; ++i)
+                                if (visit(_order[i], seg)) return true;
+                        } else {
+                            // the child on the side the ray comes from first
+                            if (negative[n.axis]) {
+                                stack[top++] = node + 1;
+                                node = n.index;
+                            } else {
+                                stack[top++] = n.index;
+                                node = node + 1;
+                            }
+                            continue;
+                        }
+                    }
+                    if (top == 0) return false;
+                    node = stack[--top];
+                }
+            }
+    };
+}
+
+namespace object
+{
+    // A `HittableList` that finds hits through a `bvh::Bvh`.
+    template<WorldLike TWorld>
+    using BvhList = AcceleratedList<TWorld, bvh::Bvh<typename TWorld::Num>>;
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <algorithm>
+
+#include "owrt.hpp"
+
+/*
+Radiance cache for diffuse interreflection:
+    - A hashed grid of cells keyed by position and the dominant axis of the normal,
+      each holding a running mean of the radiance reflected off diffuse surfaces in it
+    - Paths record what they found at every diffuse vertex and, once a cell has enough
+      samples, stop at it after `min_bounce` bounces and take the cached value instead
+    - Paths that stop at the cache record the cached value back, so light from more
+      bounces than `max_depth` propagates through the cache over passes
+    - The cache is read only during a pass. Each row collects records on its own and
+      `merge` folds them in row order afterwards, so results do not depend on threading
+*/
+namespace cache
+{
+    struct Settings
+    {
+        float cell_size = 0.25;
+        uint32_t min_count = 8;     // samples before a cell is used
+        uint32_t max_count = 256;   // older samples fade out beyond this many
+        int min_bounce = 1;         // camera hits are always traced
+        int capacity_log2 = 20;
+    };
+
+    template<std::floating_point TNum, color::Tup3Like TColor>
+    class RadianceCache
+    {
+        public:
+            using Num = TNum;
+            using Color = TColor;
+            using ColorNum = typename Color::Num;
+            using Loc = vmath::Loc3<Num>;
+            using Vec = vmath::Vec3<Num>;
+
+            struct Record
+            {
+                uint64_t key;
+                Color sum;
+                uint32_t count;
+            };
+            using Records = std::vector<Record>;
+
+        private:
+            struct Entry
+            {
+                uint64_t key = 0;
+                Color sum = Color::Black;
+                uint32_t count = 0;
+            };
+
+            Settings _settings;
+            std::vector<Entry> _entries;
+            std::vector<Records> _rows;
+
+        public:
+            explicit RadianceCache(Settings const& settings = {})
+                : _settings { settings }
+                , _entries(size_t(1) << settings.capacity_log2)
+            { }
+
+            auto settings() const -> Settings const& { return _settings; }
+
+            auto key(Loc const& p, Vec const& n) const -> uint64_t
+            {
+                auto cell = [&](Num v) { return uint64_t(int64_t(std::floor(v / Num(_settings.cell_size)))); };
+                auto a = vmath::abs(n);
+                auto axis = a.x > a.y && a.x > a.z ? (n.x > 0 ? 0 : 1)
+                    : a.y > a.z ? (n.y > 0 ? 2 : 3)
+                    : (n.z > 0 ? 4 : 5);
+                // zero marks an empty slot
+                return common::hash_combine(axis, cell(p.x), cell(p.y), cell(p.z)) | 1;
+            }
+
+            // The cached radiance of a cell, once it has seen `min_count` samples.
+            auto lookup(uint64_t key) const -> std::optional<Color>
+            {
+                auto e = find(key);
+                if (!e || e->count < _settings.min_count) return std::nullopt;
+                return (ColorNum(1) / e->count) * e->sum;
+            }
+
+            // Clears the per row records, call before scheduling a pass.
+            void begin_pass(size_t rows)
+            {
+                _rows.resize(rows);
+                for (auto& r : _rows) r.clear();
+            }
+
+            auto row(size_t j) -> Records& { return _rows[j]; }
+
+            // Folds the records of the finished pass in, in row order.
+            void merge()
+            {
+                for (auto const& row : _rows)
+                    for (auto const& r : row)
+                    {
+                        auto e = insert(r.key);
+                        if (!e) continue;
+
+                        e->sum += r.sum;
+                        e->count += r.count;
+                        if (e->count > _settings.max_count) {
+                            e->sum *= ColorNum(_settings.max_count) / e->count;
+                            e->count = _settings.max_count;
+                        }
+                    }
+            }
+
+            auto filled() const
+            {
+                return std::ranges::count_if(_entries, [](auto const& e) { return e.key != 0; });
+            }
+
+        private:
+            static constexpr auto max_probe = 16;
+
+            auto mask() const { return _entries.size() - 1; }
+
+            auto find(uint64_t key) const -> Entry const*
+            {
+                for (size_t i = 0, slot = key & mask(); i < max_probe; ++i, slot = (slot + 1) & mask())
+                {
+                    if (_entries[slot].key == key) return &_entries[slot];
+                    if (_entries[slot].key == 0) return nullptr;
+                }
+                return nullptr;
+            }
+
+            // Full neighbourhoods drop the record rather than evicting.
+            auto insert(uint64_t key) -> Entry*
+            {
+                for (size_t i = 0, slot = key & mask(); i < max_probe; ++i, slot = (slot + 1) & mask())
+                {
+                    auto& e = _entries[slot];
+                    if (e.key == 0) e.key = key;
+                    if (e.key == key) return &e;
+                }
+                return nullptr;
+            }
+    };
+
+    // Collects the diffuse vertices of one path at a time into the records of one row.
+    template<class TCache>
+    class PathRecorder
+    {
+        public:
+            using Num = typename TCache::Num;
+            using Color = typename TCache::Color;
+            using ColorNum = typename Color::Num;
+            using Records = typename TCache::Records;
+
+        private:
+            struct Vertex
+            {
+                uint64_t key;
+                Color before;       // radiance gathered before the vertex reflected anything
+                Color throughput;   // path weight arriving at the vertex
+            };
+
+            TCache const& _cache;
+            Records& _records;
+            std::array<Vertex, 16> _vertices;
+            size_t _count = 0;
+
+        public:
+            PathRecorder(TCache const& cache, Records& records)
+                : _cache { cache }, _records { records }
+            { }
+
+            auto cache() const -> TCache const& { return _cache; }
+
+            void add(uint64_t key, Color const& before, Color const& throughput)
+            {
+                if (_count < _vertices.size())
+                    _vertices[_count++] = { key, before, throughput };
+            }
+
+            // What each vertex reflected is everything the path gathered after it, over its throughput.
+            void finish(Color const& radiance)
+            {
+                for (auto const& v : std::span { _vertices.data(), _count })
+                {
+                    auto d = radiance - v.before;
+                    auto over = [](ColorNum a, ColorNum t) { return t > 0 ? a / t : ColorNum(0); };
+                    _records.push_back({ v.key, Color { over(d.r, v.throughput.r), over(d.g, v.throughput.g), over(d.b, v.throughput.b) }, 1 });
+                }
+                _count = 0;
+            }
+
+            // Sums records of the same cell, so a row hands over one record per cell it saw.
+            void compact()
+            {
+                std::ranges::sort(_records, {}, &TCache::Record::key);
+                size_t out = 0;
+                for (size_t i = 0; i < _records.size(); ++i)
+                {
+                    if (out > 0 && _records[out - 1].key == _records[i].key) {
+                        _records[out - 1].sum += _records[i].sum;
+                        _records[out - 1].count += _records[i].count;
+                    } else {
+                        _records[out++] = _records[i];
+                    }
+                }
+                _records.resize(out);
+            }
+    };
+}
@@ -8,8 +8,8 @@ namespace camera
     concept Camera = requires {
         typename T::Num;
         requires std::same_as<typename T::Num, TNum>;
-    } and requires (T c, TNum u, TNum v) {
-        { c.get_ray(u, v) } -> std::convertible_to<vmath::Ray<TNum>>;
+    } and requires (T c, TNum u, TNum v, sampler::Independent rs) {
+        { c.get_ray(u, v, rs) } -> std::convertible_to<vmath::Ray<TNum>>;
     };
 
     template<dispatch::WorldLike TWorld>
@@ -43,7 +43,7 @@ namespace camera
             ) {
                 auto theta = common::degrees_to_radians(fov_vertical);
                 auto h = std::tan(theta/2);
-                auto viewport_height = 2.0 * h;
+                auto viewport_height = 2 * h;
                 auto viewport_width = aspect_ratio * viewport_height;
 
                 _w = unit_vector(look_from - look_to);
@@ -58,8 +58,9 @@ namespace camera
                 _lens_radius = aperture / 2;
             }
 
-            Ray get_ray(Num s, Num t, common::RandomState& rs) const {
-                auto rd = _lens_radius * vmath::rand_in_disk<Vec>(rs);
+            Ray get_ray(Num s, Num t, sampler::Sampler auto& rs) const {
+                auto [u1, u2] = sampler::get2d<Num>(rs);
+                auto rd = _lens_radius * vmath::concentric_disk<Vec>(u1, u2);
                 auto offset = _u * rd.x + _v * rd.y;
                 return Ray { 
                     _origin + offset,
@@ -6,6 +6,7 @@
 #include <iostream>
 
 #include "common.hpp"
+#include "simd.hpp"
 
 /*
 Notable changes from the book:
@@ -37,13 +38,14 @@ namespace color
     /* Classes */
 
     template<typename TActual, typename TNum>
-    struct Tup3Base
+    struct alignas(simd::alignment<TNum>) Tup3Base
     {
         using Num = TNum;
 
         Num r = 0;
         Num g = 0;
         Num b = 0;
+        [[no_unique_address]] simd::Pad<Num> _pad;
 
         /* no constructors to not interfere with tuple-ification */
 
@@ -63,6 +65,11 @@ namespace color
 
         constexpr auto operator+=(Tup3Like auto vec)
         {
+            if constexpr (simd::Packed<TActual> and std::same_as<TActual, decltype(vec)>) if !consteval {
+                auto& self = static_cast<TActual&>(*this);
+                self = simd::store<TActual>(simd::load(self) + simd::load(vec));
+                return *this;
+            }
             r += get<0>(vec);
             g += get<1>(vec);
             b += get<2>(vec);
@@ -71,6 +78,11 @@ namespace color
         
         constexpr auto operator*=(TNum c)
         {
+            if constexpr (simd::Packed<TActual>) if !consteval {
+                auto& self = static_cast<TActual&>(*this);
+                self = simd::store<TActual>(simd::load(self) * simd::splat(c));
+                return *this;
+            }
             r *= c;
             g *= c;
             b *= c;
@@ -80,6 +92,8 @@ namespace color
         constexpr auto operator/=(TNum t) {
             return *this *= 1/t;
         }
+
+        constexpr bool operator==(Tup3Base const&) const = default;
     };
     template <unsigned I, typename TActual, typename TNum>
     constexpr auto& get(Tup3Base<TActual, TNum>& n)
@@ -137,6 +151,14 @@ namespace color
             << static_cast<int64_t>(c.b);
     }
 
+    // Relative luminance of linear rgb (Rec. 709 primaries).
+    template<Tup3Like TN3>
+    constexpr auto luminance(TN3 const& c)
+    {
+        using Num = typename TN3::Num;
+        return Num(0.2126) * c.r + Num(0.7152) * c.g + Num(0.0722) * c.b;
+    }
+
     template<Tup3Like TDst, Tup3Like TSrc>
     constexpr auto color_cast(TSrc src) -> TDst
     {
@@ -150,24 +172,36 @@ namespace color
     template<Tup3Like TN3>
     constexpr auto operator+(TN3 const& u, TN3 const& v)
     {
+        if constexpr (simd::Packed<TN3>) if !consteval {
+            return simd::store<TN3>(simd::load(u) + simd::load(v));
+        }
         return TN3 { u.r + v.r, u.g + v.g, u.b + v.b };
     }
 
     template<Tup3Like TN3>
     constexpr auto operator-(TN3 const& u, TN3 const& v)
     {
+        if constexpr (simd::Packed<TN3>) if !consteval {
+            return simd::store<TN3>(simd::load(u) - simd::load(v));
+        }
         return TN3 { u.r - v.r, u.g - v.g, u.b - v.b };
     }
     
     template<Tup3Like TN3>
     constexpr auto operator*(TN3 const& u, TN3 const& v)
     {
+        if constexpr (simd::Packed<TN3>) if !consteval {
+            return simd::store<TN3>(simd::load(u) * simd::load(v));
+        }
         return TN3 { u.r * v.r, u.g * v.g, u.b * v.b };
     }
 
     template<Tup3Like TN3>
     constexpr auto operator*(typename TN3::Num t, TN3 const& v)
     {
+        if constexpr (simd::Packed<TN3>) if !consteval {
+            return simd::store<TN3>(simd::splat(t) * simd::load(v));
+        }
         return TN3 { t*v.r, t*v.g, t*v.b };
     }
 
@@ -184,6 +218,8 @@ namespace color
     }
 }
 
+static_assert(sizeof(color::Color3<uint8_t>) == 3, "8-bit colors are written out as packed rgb");
+
 template <typename TNum>
 struct std::tuple_size<color::Color3<TNum>>
     : public integral_constant<std::size_t, color::Color3<TNum>::size()> {};
@@ -4,7 +4,10 @@
 #include <stdexcept>
 #include <cmath>
 #include <random>
+#include <cstdint>
 #include <iostream>
+#include <limits>
+#include <concepts>
 
 namespace common
 {
@@ -20,12 +23,43 @@ namespace common
         return TNum(degrees * pi / 180.0);
     }
 
+    // Bound on the relative error of `n` successive floating point operations.
+    template<std::floating_point TNum>
+    constexpr auto gamma(int n) {
+        constexpr auto machine_epsilon = std::numeric_limits<TNum>::epsilon() * TNum(0.5);
+        return (n * machine_epsilon) / (1 - n * machine_epsilon);
+    }
+
+    // splitmix64 finalizer, used to derive independent seeds from keys
+    constexpr auto hash_mix(uint64_t x) -> uint64_t
+    {
+        x += 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+    constexpr auto hash_combine(uint64_t seed, std::convertible_to<uint64_t> auto... keys) -> uint64_t
+    {
+        ((seed = hash_mix(seed ^ hash_mix(uint64_t(keys)))), ...);
+        return seed;
+    }
+
     struct RandomState {
         std::mt19937 generator;
 
         inline auto sub()
         {
-            return RandomState { { generator } };
+            return RandomState { std::mt19937 { generator() } };
+        }
+
+        // A stream that only depends on its keys, so work can be split across
+        // threads in any order and still produce identical results.
+        static inline auto seeded(uint64_t seed, std::convertible_to<uint64_t> auto... keys)
+        {
+            auto h = hash_combine(seed, keys...);
+            std::seed_seq seq { uint32_t(h), uint32_t(h >> 32) };
+            return RandomState { std::mt19937 { seq } };
         }
     };
 
@@ -36,6 +70,15 @@ namespace common
         return distribution(rs.generator);
     }
 
+    // Multiple importance sampling weight for a sample drawn with density `f_pdf`
+    // against one other strategy with density `g_pdf` (Veach's power heuristic, beta = 2).
+    template<std::floating_point TNum>
+    constexpr auto power_heuristic(TNum f_pdf, TNum g_pdf)
+    {
+        auto f = f_pdf * f_pdf, g = g_pdf * g_pdf;
+        return f / (f + g);
+    }
+
     /* Concepts */
 
     template<typename T>
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+
+#include "owrt.hpp"
+
+#include "golden.hpp"
+
+/*
+Convergence benchmark:
+    Renders each scene with every sampling variant at a few sample counts and
+    reports the time taken and the error against a high sample count reference
+    of the plain variant, rendered with another seed so its samples are not shared.
+    Error is relative MSE, so dark and bright regions count alike, with the worst
+    `outlier_share` of pixels left out so a few fireflies do not decide the ranking.
+*/
+namespace converge
+{
+    struct Variant
+    {
+        char const* name;
+        bool cache = false;
+        bool guiding = false;
+        bool caustics = false;
+    };
+
+    constexpr char const* scenes[] = { "lamp_spheres", "glass_lamp" };
+    constexpr Variant variants[] = { { "plain" }, { "cached", true }, { "guided", false, true }, { "photons", false, false, true } };
+    constexpr int sample_counts[] = { 4, 16, 64 };
+
+    constexpr int width = 96, height = 54, max_depth = 8;
+    constexpr int samples_per_iter = 4;
+    constexpr int reference_samples = 1024;
+    constexpr uint64_t reference_seed = 1;
+    constexpr double outlier_share = 0.005;
+
+    template<typename TColor>
+    auto relative_mse(std::vector<TColor> const& image, std::vector<TColor> const& reference) -> double
+    {
+        std::vector<double> errors(image.size());
+        for (size_t p = 0; p < image.size(); ++p)
+        {
+            auto d = image[p] - reference[p];
+            auto r = reference[p];
+            errors[p] = (d.r * d.r + d.g * d.g + d.b * d.b) / (r.r * r.r + r.g * r.g + r.b * r.b + 1e-2);
+        }
+        std::ranges::sort(errors);
+        auto kept = errors.size() - size_t(errors.size() * outlier_share);
+        return std::accumulate(errors.begin(), errors.begin() + kept, 0.0) / kept;
+    }
+
+    template<dispatch::WorldLike TWorld>
+    void run(auto& scheduler)
+    {
+        using clock = std::chrono::steady_clock;
+
+        std::cerr << std::left << std::setw(16) << "scene" << std::setw(8) << "variant" << std::right
+            << std::setw(6) << "spp" << std::setw(10) << "seconds" << std::setw(12) << "relMSE" << "\n";
+
+        for (auto name : scenes)
+        {
+            object::BvhList<TWorld> world;
+            golden::Case base { name, width, height, reference_samples, 64, max_depth };
+            auto cam = golden::build_case(base, world);
+            world.build();
+            auto lights = light::LightBVH<TWorld>::build(world);
+            render::Scene scene { world, lights };
+
+            auto reference = golden::accumulate_case<TWorld>(scheduler, base, scene, cam, reference_seed);
+
+            for (auto const& v : variants)
+                for (auto spp : sample_counts)
+                {
+                    golden::Case c { name, width, height, spp, samples_per_iter, max_depth, false, v.cache, v.guiding, v.caustics };
+
+                    auto start = clock::now();
+                    auto image = golden::accumulate_case<TWorld>(scheduler, c, scene, cam);
+                    auto seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+                    std::cerr << std::left << std::setw(16) << name << std::setw(8) << v.name << std::right
+                        << std::setw(6) << spp << std::setw(10) << std::fixed << std::setprecision(3) << seconds
+                        << std::setw(12) << std::scientific << std::setprecision(3) << relative_mse(image, reference)
+                        << std::defaultfloat << "\n";
+                }
+        }
+    }
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "owrt.hpp"
+
+#include "render.hpp"
+#include "memory.hpp"
+
+/*
+Edge avoiding a-trous wavelet filter (Dammertz et al. 2010):
+    - Filters illumination, the color divided by the first hit albedo, so texture
+      and material edges come back sharp when the albedo is multiplied back in
+    - Each pass is a 5x5 B3-spline kernel with its taps spread `2^i` pixels apart,
+      so a few passes cover a wide footprint at 25 taps a pixel
+    - Taps are weighted down across differences in color, normal and albedo
+    - Rows are filtered as tasks on the scheduler; a pass only reads the previous
+      one, so the result does not depend on the thread count
+*/
+namespace denoise
+{
+    using common::map;
+
+    struct Settings
+    {
+        int iterations = 5;
+        float sigma_color = 0.25;   // on tone mapped illumination, halved every pass
+        float normal_power = 64;
+        float sigma_albedo = 0.1;
+    };
+
+    // Filters `samples` (sums over `sample_count` samples and the matching guide sums) into `out`, averaged.
+    template<dispatch::WorldLike TWorld>
+    void atrous(
+        auto& scheduler,
+        render::Frame const& frame,
+        std::span<typename TWorld::Color const> samples,
+        render::Guides<TWorld> guides,
+        int sample_count,
+        std::span<typename TWorld::Color> out,
+        Settings const& settings = {}
+    ) {
+        using Num = typename TWorld::Num;
+        using Vec = typename TWorld::Vec;
+        using Color = typename TWorld::Color;
+        using ColorNum = typename Color::Num;
+
+        auto const width = frame.width, height = frame.height;
+        auto const size = size_t(width * height);
+
+        // the working images of every call come from the same scratch blocks
+        memory::Rewind scratch;
+        auto ping = scratch.vector<Color>(size), pong = scratch.vector<Color>(size), albedo = scratch.vector<Color>(size);
+        auto normal = scratch.vector<Vec>(size);
+
+        // albedo is kept off zero so dividing it out can be undone exactly
+        constexpr auto min_albedo = ColorNum(1e-3);
+        auto const inv_count = ColorNum(1) / sample_count;
+
+        for (auto j = 0; j < height; ++j)
+            scheduler.schedule([=, illum = std::span { ping }, albedo = std::span { albedo }, normal = std::span { normal }](auto&) {
+                for (auto p = j * width; p < (j + 1) * width; ++p)
+                {
+                    albedo[p] = map(inv_count * guides.albedo[p], [=](auto a) { return std::max(a, min_albedo); });
+                    auto n = guides.normal[p];
+                    normal[p] = n.length_squared() > 0 ? unit_vector(n) : Vec {};
+
+                    auto c = inv_count * samples[p];
+                    illum[p] = Color { c.r / albedo[p].r, c.g / albedo[p].g, c.b / albedo[p].b };
+                }
+            });
+        scheduler.flush();
+
+        auto tone_map = [](Color const& c) { return map(c, [](auto v) { return v / (1 + v); }); };
+        auto distance_squared = [](Color const& a, Color const& b) {
+            auto d = a - b;
+            return d.r * d.r + d.g * d.g + d.b * d.b;
+        };
+
+        constexpr ColorNum kernel[] = { ColorNum(1) / 16, ColorNum(1) / 4, ColorNum(3) / 8, ColorNum(1) / 4, ColorNum(1) / 16 };
+
+        std::span<Color> src { ping }, dst { pong };
+        auto sigma_color = ColorNum(settings.sigma_color);
+        for (auto i = 0; i < settings.iterations; ++i, sigma_color /= 2)
+        {
+            auto const step = 1 << i;
+            auto const inv_color = 1 / (sigma_color * sigma_color);
+            auto const inv_albedo = 1 / ColorNum(settings.sigma_albedo * settings.sigma_albedo);
+            auto const normal_power = Num(settings.normal_power);
+
+            for (auto j = 0; j < height; ++j)
+                scheduler.schedule([=, albedo = std::span<Color const> { albedo }, normal = std::span<Vec const> { normal }](auto&) {
+                    for (auto x = 0; x < width; ++x)
+                    {
+                        auto const p = j * width + x;
+                        auto const tp = tone_map(src[p]);
+
+                        auto sum = Color::Black;
+                        auto weight_sum = ColorNum(0);
+                        for (auto ky = 0; ky < 5; ++ky)
+                        {
+                            auto const y = j + (ky - 2) * step;
+                            if (y < 0 || y >= height) continue;
+
+                            for (auto kx = 0; kx < 5; ++kx)
+                            {
+                                auto const xx = x + (kx - 2) * step;
+                                if (xx < 0 || xx >= width) continue;
+                                auto const q = y * width + xx;
+
+                                // pixels that saw the sky have no normal, and only match each other
+                                auto n_dot = dot(normal[p], normal[q]);
+                                auto both_sky = normal[p].length_squared() == 0 && normal[q].length_squared() == 0;
+                                auto w_normal = both_sky ? ColorNum(1) : ColorNum(std::pow(std::max(Num(0), n_dot), normal_power));
+
+                                auto w_color = std::exp(-distance_squared(tone_map(src[q]), tp) * inv_color);
+                                auto w_albedo = std::exp(-distance_squared(albedo[q], albedo[p]) * inv_albedo);
+
+                                auto w = (q == p ? ColorNum(1) : w_normal * w_color * w_albedo) * kernel[kx] * kernel[ky];
+                                sum += w * src[q];
+                                weight_sum += w;
+                            }
+                        }
+                        dst[p] = (1 / weight_sum) * sum;
+                    }
+                });
+            scheduler.flush();
+            std::swap(src, dst);
+        }
+
+        for (auto j = 0; j < height; ++j)
+            scheduler.schedule([=, albedo = std::span<Color const> { albedo }](auto&) {
+                for (auto p = j * width; p < (j + 1) * width; ++p)
+                    out[p] = src[p] * albedo[p];
+            });
+        scheduler.flush();
+    }
+}
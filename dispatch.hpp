@@ -1,9 +1,21 @@
 #pragma once
 
+#include <span>
+#include <array>
+#include <tuple>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <utility>
 #include <variant>
+#include <stdexcept>
+#include <algorithm>
+#include <unordered_map>
 
 #include "owrt.hpp"
 
+#include "memory.hpp"
+
 namespace dispatch
 {
     template<typename T>
@@ -11,10 +23,147 @@ namespace dispatch
         typename T::Variant;
     };
 
+    // Compact reference to one value in a `Tables`: the alternative in the top 8 bits, the index in its table below.
+    struct Handle
+    {
+        static constexpr uint32_t index_bits = 24;
+        static constexpr uint32_t max_index = (uint32_t(1) << index_bits) - 1;
+
+        uint32_t bits = 0;
+
+        constexpr Handle() = default;
+        constexpr Handle(uint32_t tag, uint32_t index) : bits { tag << index_bits | index } { }
+
+        constexpr auto tag() const -> uint32_t { return bits >> index_bits; }
+        constexpr auto index() const -> uint32_t { return bits & max_index; }
+
+        constexpr bool operator==(Handle const&) const = default;
+    };
+
+    /*
+    Values of a variant kept in one dense table per alternative rather than inline:
+        - Users hold a 4 byte `Handle` instead of the largest alternative plus its index
+        - `add` hands back the existing handle for a value already stored, so objects
+          sharing a material share its entry
+        - `visit` dispatches on the tag, like `std::visit` on the variant
+        - `group` sorts a batch by alternative and hands each run to `f` with its table,
+          so shading a run stays on one type and walks one table
+    */
+    template<typename... TVariants>
+    class Tables
+    {
+        static_assert(sizeof...(TVariants) <= 256, "tags are 8 bits");
+
+        public:
+            template<typename T>
+            static constexpr uint32_t tag_of = [] {
+                uint32_t i = 0;
+                (void)((std::same_as<T, TVariants> ? false : (++i, true)) && ...);
+                return i;
+            }();
+
+        private:
+            std::tuple<std::vector<TVariants>...> _tables;
+            std::unordered_multimap<uint64_t, Handle> _index;   // hash of tag and bytes, for `add`
+
+        public:
+            template<typename T>
+            auto add(T const& value) -> Handle
+            {
+                constexpr auto tag = tag_of<T>;
+                static_assert(tag < sizeof...(TVariants), "not an alternative of these tables");
+
+                // Values that compare equal but differ in their bytes (0 and -0) are only stored twice.
+                unsigned char bytes[sizeof(T)];
+                std::memcpy(bytes, &value, sizeof(T));
+                auto h = common::hash_combine(0, tag);
+                for (auto b : bytes) h = common::hash_combine(h, b);
+
+                auto& table = std::get<tag>(_tables);
+                auto [first, last] = _index.equal_range(h);
+                for (auto it = first; it != last; ++it)
+                    if (table[it->second.index()] == value) return it->second;
+
+                if (table.size() > Handle::max_index)
+                    throw std::length_error("table is full");
+                Handle handle { tag, uint32_t(table.size()) };
+                table.push_back(value);
+                _index.emplace(h, handle);
+                return handle;
+            }
+
+            template<typename T>
+            auto table() const -> std::span<T const> { return std::get<tag_of<T>>(_tables); }
+
+            auto size() const -> size_t { return std::apply([](auto const&... t) { return (t.size() + ...); }, _tables); }
+
+            // Memory held by the tables and, about, by the index `add` looks values up in.
+            auto bytes() const -> size_t
+            {
+                auto tables = std::apply([](auto const&... t) { return ((t.capacity() * sizeof(t[0])) + ...); }, _tables);
+                auto node = sizeof(void*) + sizeof(size_t) + sizeof(typename decltype(_index)::value_type);
+                return tables + _index.size() * node + _index.bucket_count() * sizeof(void*);
+            }
+
+            // Whether `h` refers to a stored value.
+            auto contains(Handle h) const -> bool
+            {
+                return h.tag() < sizeof...(TVariants) && visit_table(h.tag(), [&](auto const& t) { return h.index() < t.size(); });
+            }
+
+            // Calls `f(table)` with every alternative's table as a span, in tag order.
+            void each_table(auto&& f) const
+            {
+                std::apply([&](auto const&... t) { (f(std::span { t }), ...); }, _tables);
+            }
+
+            template<size_t I = 0>
+            constexpr auto visit(Handle h, auto&& f) const
+            {
+                if constexpr (I + 1 < sizeof...(TVariants))
+                    if (h.tag() != I) return visit<I + 1>(h, f);
+                return f(std::get<I>(_tables)[h.index()]);
+            }
+
+            // Reorders `items` by the alternative `handle_of(item)` refers to, keeping their order
+            // within one, and calls `f(table, run)` for each alternative that has items.
+            template<typename TItem>
+            void group(std::span<TItem> items, auto&& handle_of, auto&& f) const
+            {
+                constexpr auto n = sizeof...(TVariants);
+                std::array<size_t, n + 1> begin {};
+                for (auto const& item : items) ++begin[handle_of(item).tag() + 1];
+                for (size_t t = 0; t < n; ++t) begin[t + 1] += begin[t];
+
+                memory::Rewind scratch;
+                auto sorted = scratch.vector<TItem>(items.size());
+                auto next = begin;
+                for (auto& item : items) sorted[next[handle_of(item).tag()]++] = std::move(item);
+                std::ranges::move(sorted, items.begin());
+
+                [&]<size_t... Is>(std::index_sequence<Is...>) {
+                    ((begin[Is] < begin[Is + 1]
+                        ? f(std::span<std::tuple_element_t<Is, std::tuple<TVariants...>> const> { std::get<Is>(_tables) },
+                            items.subspan(begin[Is], begin[Is + 1] - begin[Is]))
+                        : void()), ...);
+                }(std::index_sequence_for<TVariants...> {});
+            }
+
+        private:
+            template<size_t I = 0>
+            auto visit_table(uint32_t tag, auto&& f) const
+            {
+                if constexpr (I + 1 < sizeof...(TVariants))
+                    if (tag != I) return visit_table<I + 1>(tag, f);
+                return f(std::get<I>(_tables));
+            }
+    };
+
     template<typename... TVariants>
     struct DispatchGroup
     {
         using Variant = std::variant<TVariants...>;
+        using Tables = dispatch::Tables<TVariants...>;
     };
 
     template<typename T>
@@ -62,6 +211,7 @@ namespace dispatch
 
         using MatDispatch = TMatDispatch<Self>;
         using MatVar = MatDispatch::Variant;
+        using MatTables = MatDispatch::Tables;
 
         using ObjDispatch = TObjDispatch<Self>;
         using ObjVar = ObjDispatch::Variant;
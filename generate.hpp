@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cmath>
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+#include <charconv>
+#include <stdexcept>
+#include <string_view>
+
+#include "owrt.hpp"
+
+#include "sphere.hpp"
+#include "triangle.hpp"
+#include "instance.hpp"
+#include "camera.hpp"
+
+/*
+Procedural scenes of any size:
+    - `objects` spheres, or instances of a few small prototypes, one on each jittered cell
+      of a square field, `density` of them per unit of area, so the field grows with them
+    - Materials come from a palette of `palette` entries drawn by the `mix` weights, so
+      millions of objects share a few hundred materials instead of each adding its own
+    - Objects are made one at a time from the seeded generator and go straight into the
+      world's list, reserved up front; nothing is staged on the side
+    - The same settings and seed always make the same scene
+*/
+namespace generate
+{
+    // Relative weights of the palette's material kinds.
+    struct Mix
+    {
+        float diffuse = 0.75;
+        float metal = 0.15;
+        float glass = 0.07;
+        float emissive = 0.03;
+    };
+
+    struct Settings
+    {
+        size_t objects = 1'000'000;
+        float density = 4;          // objects per unit of floor area
+        Mix mix;
+        uint32_t palette = 256;     // distinct materials
+        uint64_t seed = 1;
+        bool instances = false;     // instances of prototypes instead of spheres
+
+        // Sets the field named `key` (`objects`, `density`, `palette`, `seed`, or `mix`
+        // as the weights `diffuse,metal,glass,emissive`, missing ones zero) from `value`,
+        // false if there is no such field.
+        auto set(std::string_view key, std::string_view value) -> bool
+        {
+            auto bad = [&, given = std::string(value)] { return std::invalid_argument("generator setting " + std::string(key) + " can not be '" + given + "'"); };
+            auto parse = [&](std::string_view text, auto& out, bool positive = true) {
+                auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), out);
+                if (ec != std::errc {} || end != text.data() + text.size() || (positive && !(out > 0))) throw bad();
+            };
+
+            if (key == "objects") parse(value, objects);
+            else if (key == "density") parse(value, density);
+            else if (key == "palette") parse(value, palette);
+            else if (key == "seed") parse(value, seed, false);
+            else if (key == "mix") {
+                std::array<float*, 4> weights { &mix.diffuse, &mix.metal, &mix.glass, &mix.emissive };
+                for (auto w : weights)
+                {
+                    auto comma = std::min(value.find(','), value.size());
+                    *w = 0;
+                    if (comma > 0) {
+                        auto [end, ec] = std::from_chars(value.data(), value.data() + comma, *w);
+                        if (ec != std::errc {} || end != value.data() + comma || *w < 0) throw bad();
+                    }
+                    value.remove_prefix(std::min(comma + 1, value.size()));
+                }
+                if (!value.empty() || mix.diffuse + mix.metal + mix.glass + mix.emissive <= 0) throw bad();
+            }
+            else return false;
+            return true;
+        }
+    };
+
+    // Fills `world` as `settings` ask and returns a camera looking over the field.
+    template<class World>
+    auto scene(object::HittableList<World>& world, Settings const& settings, typename World::Num aspect_ratio)
+    {
+        using Num = typename World::Num;
+        using Loc = typename World::Loc;
+        using Vec = typename World::Vec;
+        using Color = typename World::Color;
+        using Transform = vmath::Transform<Num>;
+
+        using common::rand;
+
+        auto rs = common::RandomState::seeded(settings.seed);
+
+        // the palette, kinds drawn by their weights
+        auto const& mix = settings.mix;
+        auto total = mix.diffuse + mix.metal + mix.glass + mix.emissive;
+        std::vector<dispatch::Handle> palette;
+        palette.reserve(settings.palette);
+        for (uint32_t i = 0; i < settings.palette; ++i)
+        {
+            auto u = rand<float>(rs, 0, total);
+            if ((u -= mix.diffuse) < 0)
+                palette.push_back(world.materials.add(material::Lambertian<World>{ rand<Color>(rs) * rand<Color>(rs) }));
+            else if ((u -= mix.metal) < 0)
+                palette.push_back(world.materials.add(material::Metal<World>{ rand<Color>(rs, 0.5, 1), rand<Num>(rs, 0, 0.5) }));
+            else if ((u -= mix.glass) < 0)
+                palette.push_back(world.materials.add(material::Dielectric<World>{ rand<Num>(rs, 1.3, 1.8) }));
+            else
+                palette.push_back(world.materials.add(material::Emissive<World>{ Num(4) * rand<Color>(rs, 0.2, 1) }));
+        }
+        auto pick = [&] { return palette[std::min(size_t(rand<Num>(rs) * palette.size()), palette.size() - 1)]; };
+
+        // a field of `side` by `side`, cut into `cells` by `cells`
+        auto const count = settings.objects;
+        auto const side = std::sqrt(double(count) / settings.density);
+        auto const cells = size_t(std::ceil(std::sqrt(double(count))));
+        auto const cell = side / cells;
+
+        // a ground sphere wide enough to look flat, objects set on its surface
+        auto const ground = std::max(1000.0, 100 * side);
+        auto height_at = [&](double x, double z) { return Num(std::sqrt(ground * ground - x * x - z * z) - ground); };
+
+        world.objects.reserve(world.objects.size() + count + 1);
+        world.template add<object::Sphere>({{ 0, Num(-ground), 0 }, Num(ground), world.materials.add(material::Lambertian<World>{{ 0.5, 0.5, 0.5 }})});
+
+        // prototypes like `scenes::instances` has, a faceted ball with two beads, each in its own materials
+        constexpr int prototype_count = 8;
+        std::vector<std::shared_ptr<object::BvhList<World>>> prototypes;
+        memory::Shared<object::InstanceTable<World>> table { std::make_shared<object::InstanceTable<World>>() };
+        if (settings.instances) {
+            table->placements.reserve(count);
+            for (int p = 0; p < prototype_count; ++p)
+            {
+                auto [positions, triangles] = mesh::icosphere(1, { 0, 0.3f, 0 }, 0.3f);
+                auto& prototype = *prototypes.emplace_back(std::make_shared<object::BvhList<World>>());
+                prototype.template add<object::TriangleMesh>({ mesh::Mesh::from(std::move(positions), std::move(triangles)), pick() });
+                prototype.template add<object::Sphere>({{ 0.12, 0.65, 0 }, 0.1, pick() });
+                prototype.template add<object::Sphere>({{ -0.12, 0.65, 0 }, 0.1, pick() });
+                prototype.build();
+            }
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto x = (double(i % cells) + rand<double>(rs, 0.2, 0.8)) * cell - side / 2;
+            auto z = (double(i / cells) + rand<double>(rs, 0.2, 0.8)) * cell - side / 2;
+            auto y = height_at(x, z);
+
+            if (settings.instances) {
+                // the prototype is 0.6 across, scaled to at most 0.9 of a cell
+                auto size = Num(cell) * rand<Num>(rs, 0.9, 1.5);
+                auto const& prototype = prototypes[std::min(int(rand<Num>(rs) * prototype_count), prototype_count - 1)];
+                auto turn = Transform::rotate(Vec::Up, 360 * rand<Num>(rs));
+                auto place = Transform::translate({ Num(x), y, Num(z) });
+                world.template add<object::Instance>(object::Instance<World>::place(table, prototype, place * turn * Transform::scale(size)));
+            } else {
+                auto radius = Num(cell) * rand<Num>(rs, 0.15, 0.3);
+                world.template add<object::Sphere>({{ Num(x), y + radius, Num(z) }, radius, pick() });
+            }
+        }
+
+        Loc look_from { Num(0.45 * side + 2), Num(0.3 * side + 1), Num(0.6 * side + 3) };
+        Loc look_to { 0, 0, 0 };
+        Num dist_to_focus = (look_from - look_to).length();
+        Num aperture = 0;
+
+        return camera::SimpleCamera<World>(
+            look_from, look_to, Vec::Up,
+            40, aspect_ratio,
+            aperture, dist_to_focus);
+    }
+}
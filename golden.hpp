@@ -0,0 +1,343 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iomanip>
+#include <filesystem>
+
+#include "owrt.hpp"
+
+#include "scenes.hpp"
+#include "scenefile.hpp"
+#include "light.hpp"
+#include "render.hpp"
+#include "denoise.hpp"
+#include "scheduler.hpp"
+
+/*
+Golden image regression:
+    Renders small fixed scenes with a fixed seed and sample count and compares
+    the quantized result against reference images checked in under `golden/`.
+    Each case is rendered on one thread and on many threads first; the two must
+    be bit identical or the case fails regardless of the reference.
+
+    A bit identical image (same hash) is a pass. Otherwise the images are diffed
+    per pixel, small numeric drift (another compiler, `-march`, fma contraction)
+    is tolerated, anything more is reported as a failure.
+
+    The sampling mappings of `vmath` are checked alongside by their moments.
+*/
+namespace golden
+{
+    using Pixel = color::Color3<uint8_t>;
+    using Image = std::vector<Pixel>;
+
+    struct Case
+    {
+        char const* name;
+        int width;
+        int height;
+        int samples_per_pixel;
+        int samples_per_iter;
+        int max_depth;
+        bool denoise = false;
+        bool cache = false;
+        bool guiding = false;
+        bool caustics = false;
+    };
+
+    constexpr Case cases[] = {
+        { "five_spheres", 64, 36, 16, 4, 8 },
+        { "random_scene", 64, 36, 8, 4, 8 },
+        { "lamp_spheres", 64, 36, 16, 4, 8 },
+        { "many_lamps", 64, 36, 8, 4, 8 },
+        { "lamp_spheres_denoised", 64, 36, 8, 4, 8, true },
+        { "lamp_spheres_cached", 64, 36, 8, 2, 8, false, true },
+        { "glass_lamp", 64, 36, 16, 4, 8 },
+        { "glass_lamp_guided", 64, 36, 16, 4, 8, false, false, true },
+        { "glass_lamp_photons", 64, 36, 16, 4, 8, false, false, false, true },
+        { "lamp_spheres_photons", 64, 36, 8, 4, 8, false, false, false, true },
+        { "mesh_lamp", 64, 36, 16, 4, 8 },
+        { "instances", 64, 36, 8, 4, 8 },
+        { "mesh_lamp_file", 64, 36, 16, 4, 8 },
+    };
+
+    // tolerated drift: mean absolute channel error, and share of pixels off by more than `pixel_slack`
+    constexpr double mean_tolerance = 0.5;
+    constexpr double outlier_tolerance = 0.02;
+    constexpr int pixel_slack = 2;
+
+    constexpr auto hash(Image const& image) -> uint64_t
+    {
+        // FNV-1a
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (auto const& p : image)
+            for (auto c : { p.r, p.g, p.b })
+                h = (h ^ c) * 0x100000001b3ull;
+        return h;
+    }
+
+    inline auto write_ppm(std::string const& path, Image const& image, int width, int height) -> bool
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << "P6\n" << width << ' ' << height << "\n255\n";
+        out.write(reinterpret_cast<char const*>(image.data()), image.size() * sizeof(Pixel));
+        return bool(out);
+    }
+
+    inline auto read_ppm(std::string const& path, int width, int height) -> std::optional<Image>
+    {
+        std::ifstream in(path, std::ios::binary);
+        std::string magic;
+        int w, h, max;
+        if (!(in >> magic >> w >> h >> max) || magic != "P6" || w != width || h != height || max != 255)
+            return std::nullopt;
+        in.get();
+
+        Image image(width * height);
+        if (!in.read(reinterpret_cast<char*>(image.data()), image.size() * sizeof(Pixel)))
+            return std::nullopt;
+        return image;
+    }
+
+    // Renders a case to averaged, linear pixels.
+    template<dispatch::WorldLike TWorld>
+    auto accumulate_case(auto& scheduler, Case const& c, auto const& scene, auto const& cam, uint64_t seed = 0) -> std::vector<typename TWorld::Color>
+    {
+        using Num = typename TWorld::Num;
+        using Vec = typename TWorld::Vec;
+        using Color = typename TWorld::Color;
+
+        render::Frame frame { c.width, c.height, c.max_depth, seed };
+        std::vector<Color> samples(c.width * c.height);
+
+        std::vector<Color> albedo(c.denoise ? samples.size() : 0);
+        std::vector<Vec> normal(c.denoise ? samples.size() : 0);
+        render::PassOptions<TWorld> options { .guides = { albedo, normal } };
+
+        std::optional<cache::RadianceCache<Num, Color>> radiance_cache;
+        if (c.cache) options.cache = &radiance_cache.emplace(cache::Settings { .capacity_log2 = 16 });
+
+        std::optional<guiding::SDTree<Num>> guide;
+        if (c.guiding) options.guiding = &guide.emplace(scene.world.bounds());
+
+        std::optional<photon::CausticMap<Num, Color>> caustics;
+        if (c.caustics) {
+            photon::trace<TWorld>(scheduler, scene, caustics.emplace(photon::Settings { .photon_count = 1 << 16 }));
+            options.caustics = &*caustics;
+        }
+
+        // passes accumulate into the same pixels, so each has to finish before the next starts
+        for (auto s = 0; s < c.samples_per_pixel; s += c.samples_per_iter)
+        {
+            render::schedule_pass<TWorld>(scheduler, scene, cam, std::span { samples }, frame,
+                s, std::min(c.samples_per_iter, c.samples_per_pixel - s), options);
+            scheduler.flush();
+            if (options.cache) options.cache->merge();
+            if (options.guiding) options.guiding->merge();
+        }
+
+        std::vector<Color> result(samples.size());
+        if (c.denoise) {
+            denoise::atrous<TWorld>(scheduler, frame, std::span<Color const> { samples }, options.guides, c.samples_per_pixel, std::span { result });
+        } else {
+            for (size_t p = 0; p < samples.size(); ++p)
+                result[p] = (typename Color::Num(1) / c.samples_per_pixel) * samples[p];
+        }
+        return result;
+    }
+
+    template<dispatch::WorldLike TWorld>
+    auto render_case(auto& scheduler, Case const& c, auto const& scene, auto const& cam) -> Image
+    {
+        using Color = typename TWorld::Color;
+
+        auto pixels = accumulate_case<TWorld>(scheduler, c, scene, cam);
+        Image image(pixels.size());
+        render::quantize(std::span<Color const> { pixels }, std::span { image }, render::Frame { c.width, c.height, c.max_depth }, 1);
+        return image;
+    }
+
+    template<class TList>
+    auto build_case(Case const& c, TList& world)
+    {
+        using TWorld = typename TList::World;
+        using Num = typename TWorld::Num;
+        auto aspect_ratio = Num(c.width) / Num(c.height);
+
+        if (std::string_view { c.name }.starts_with("random_scene"))
+            return scenes::random_scene(world, aspect_ratio, 4);
+        if (std::string_view { c.name }.starts_with("lamp_spheres"))
+            return scenes::lamp_spheres(world, aspect_ratio);
+        if (std::string_view { c.name }.starts_with("glass_lamp"))
+            return scenes::glass_lamp(world, aspect_ratio);
+        if (std::string_view { c.name } == "many_lamps")
+            return scenes::many_lamps(world, aspect_ratio, 4);
+        if (std::string_view { c.name } == "instances")
+            return scenes::instances(world, aspect_ratio, 4);
+        if (std::string_view { c.name }.starts_with("mesh_lamp")) {
+            // through a file, so the mapped path is what gets rendered
+            auto path = std::filesystem::temp_directory_path() / "owrt_golden_icosphere.mesh";
+            auto [positions, triangles] = mesh::icosphere(3, { -0.6f, 0.6f, 0.1f }, 0.6f);
+            mesh::write(path, positions, triangles);
+            if (std::string_view { c.name } == "mesh_lamp")
+                return scenes::mesh_lamp(world, aspect_ratio, path);
+
+            // written to a scene file with its BVHs and loaded back, which must not change the image
+            TList original;
+            auto cam = scenes::mesh_lamp(original, aspect_ratio, path);
+            original.build();
+            auto scene_path = std::filesystem::temp_directory_path() / "owrt_golden.scene";
+            scenefile::write(scene_path, original, cam, { c.width, c.height, c.samples_per_pixel, c.samples_per_iter, c.max_depth });
+            return scenefile::load(scene_path, world).camera;
+        }
+        return scenes::five_spheres(world, aspect_ratio);
+    }
+
+    /*
+    Sampling moments:
+        A million points of each closed form mapping, mapped in batches as photon emission
+        does, must have the moments of their distribution within a few times the sampling
+        error: E[r^2] = 1/2 on the disk, E[z] = 1/2 on the hemisphere and 2/3 for the cosine
+        lobe, E[z] = 0 and E[z^2] = 1/3 on the sphere, E[r^2] = 3/5 in the ball.
+    */
+    template<dispatch::WorldLike TWorld>
+    auto moments() -> int
+    {
+        using Num = typename TWorld::Num;
+        using Vec = typename TWorld::Vec;
+
+        constexpr size_t count = 1'000'000;
+        constexpr double tolerance = 2e-3;
+
+        common::RandomState rs;
+        std::vector<Num> u1(count), u2(count), u3(count), x(count), y(count), z(count);
+        for (size_t i = 0; i < count; ++i) {
+            u1[i] = common::rand<Num>(rs);
+            u2[i] = common::rand<Num>(rs);
+            u3[i] = common::rand<Num>(rs);
+        }
+        vmath::Batch3<Num> out { x, y, z };
+        auto mean = [&](auto&& f) {
+            double sum = 0;
+            for (size_t i = 0; i < count; ++i) sum += f(double(x[i]), double(y[i]), double(z[i]));
+            return sum / count;
+        };
+        auto r2 = [](double x, double y, double z) { return x * x + y * y + z * z; };
+        auto z1 = [](double, double, double z) { return z; };
+        auto z2 = [](double, double, double z) { return z * z; };
+
+        struct Moment
+        {
+            char const* name;
+            double value;
+            double expected;
+        };
+        std::vector<Moment> moments;
+
+        vmath::concentric_disk_n<Vec>(u1, u2, out);
+        moments.push_back({ "disk E[r^2]", mean(r2), 1. / 2 });
+        vmath::uniform_hemisphere_n<Vec>(u1, u2, out);
+        moments.push_back({ "hemisphere E[z]", mean(z1), 1. / 2 });
+        vmath::cosine_hemisphere_n<Vec>(u1, u2, out);
+        moments.push_back({ "cosine E[z]", mean(z1), 2. / 3 });
+        vmath::uniform_sphere_n<Vec>(u1, u2, out);
+        moments.push_back({ "sphere E[z]", mean(z1), 0 });
+        moments.push_back({ "sphere E[z^2]", mean(z2), 1. / 3 });
+        for (size_t i = 0; i < count; ++i) {
+            auto p = vmath::uniform_ball<Vec>(u1[i], u2[i], u3[i]);
+            x[i] = p.x, y[i] = p.y, z[i] = p.z;
+        }
+        moments.push_back({ "ball E[r^2]", mean(r2), 3. / 5 });
+
+        int failures = 0;
+        for (auto const& [name, value, expected] : moments)
+        {
+            bool pass = std::abs(value - expected) <= tolerance;
+            std::cerr << std::left << std::setw(24) << name << std::right << std::fixed
+                << std::setw(16) << std::setprecision(6) << value << std::defaultfloat << "  "
+                << (pass ? "ok" : "FAIL") << (pass ? "" : " (expected " + std::to_string(expected) + ")") << "\n";
+            if (!pass) ++failures;
+        }
+        return failures;
+    }
+
+    // Returns the number of failed cases and moments; `update` rewrites the references instead.
+    template<dispatch::WorldLike TWorld, class TThreadLocal>
+    auto run(std::string const& dir, bool update) -> int
+    {
+        scheduler::Scheduler<1, TThreadLocal> serial;
+        scheduler::Scheduler<8, TThreadLocal> parallel;
+
+        int failures = 0;
+        for (auto const& c : cases)
+        {
+            object::BvhList<TWorld> world;
+            auto cam = build_case(c, world);
+            if (world.accel.nodes().empty()) world.build();
+            auto lights = light::LightBVH<TWorld>::build(world);
+            render::Scene scene { world, lights };
+
+            auto image = render_case<TWorld>(serial, c, scene, cam);
+            auto path = dir + "/" + c.name + ".ppm";
+
+            std::cerr << std::left << std::setw(24) << c.name << std::right
+                << std::hex << std::setw(16) << std::setfill('0') << hash(image)
+                << std::dec << std::setfill(' ') << "  ";
+
+            if (render_case<TWorld>(parallel, c, scene, cam) != image) {
+                std::cerr << "FAIL (thread count changed the image)\n";
+                ++failures;
+                continue;
+            }
+
+            if (update) {
+                std::filesystem::create_directories(dir);
+                if (!write_ppm(path, image, c.width, c.height)) {
+                    std::cerr << "FAIL (could not write " << path << ")\n";
+                    ++failures;
+                    continue;
+                }
+                std::cerr << "updated\n";
+                continue;
+            }
+
+            auto reference = read_ppm(path, c.width, c.height);
+            if (!reference) {
+                std::cerr << "FAIL (no reference at " << path << ")\n";
+                ++failures;
+                continue;
+            }
+            if (hash(*reference) == hash(image)) {
+                std::cerr << "ok\n";
+                continue;
+            }
+
+            double total = 0;
+            size_t outliers = 0;
+            for (size_t p = 0; p < image.size(); ++p)
+            {
+                int worst = 0;
+                for (auto [a, b] : { std::pair { image[p].r, (*reference)[p].r },
+                                     std::pair { image[p].g, (*reference)[p].g },
+                                     std::pair { image[p].b, (*reference)[p].b } })
+                {
+                    auto d = std::abs(int(a) - int(b));
+                    total += d;
+                    worst = std::max(worst, d);
+                }
+                if (worst > pixel_slack) ++outliers;
+            }
+            auto mean = total / (image.size() * 3);
+            auto outlier_share = double(outliers) / image.size();
+
+            bool pass = mean <= mean_tolerance && outlier_share <= outlier_tolerance;
+            std::cerr << (pass ? "ok (tolerant)" : "FAIL")
+                << " mean " << mean << ", " << outlier_share * 100 << "% pixels off\n";
+            if (!pass) ++failures;
+        }
+
+        return failures + moments<TWorld>();
+    }
+}
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <span>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <algorithm>
+
+#include "owrt.hpp"
+
+#include "bounds.hpp"
+#include "memory.hpp"
+
+/*
+Uniform grid over primitives given by their boxes:
+    - Built in two linear passes, counting the primitives of every cell and then filling
+      them in, into one flat array indexed by cell
+    - About `density` cells per primitive, shaped after the extent of the primitives
+    - Primitives far larger than the typical one (a ground plane sphere) are kept out of
+      the cells and tested by every ray, so they neither stretch the grid nor fill it
+    - With `two_level`, cells holding more than `max_cell` primitives get a grid of their own
+    - Traversal walks the cells along the ray with a 3D-DDA (Amanatides and Woo 1987) and
+      stops after the first cell that ends beyond the closest hit
+    - Build scratch lives in the thread's `memory::scratch` arena
+*/
+namespace grid
+{
+    struct Settings
+    {
+        float density = 2;          // cells per primitive
+        bool two_level = false;
+        uint32_t max_cell = 16;     // primitives a cell holds before it gets a grid of its own
+        float large = 64;           // times the median diagonal, past which a primitive is left out of the cells
+        int max_resolution = 512;   // cells along any axis
+    };
+
+    template<std::floating_point TNum>
+    class Grid
+    {
+        public:
+            using Num = TNum;
+            using Bounds = vmath::Bounds3<Num>;
+            using Loc = vmath::Loc3<Num>;
+
+            using Settings = grid::Settings;
+
+            static constexpr uint32_t none = ~uint32_t(0);
+
+        private:
+            Settings _settings;
+            Bounds _bounds;                     // of the cells, not of the large primitives
+            std::array<int, 3> _resolution {};
+            std::array<Num, 3> _cell_size {};
+            std::vector<uint32_t> _begin;       // the primitives of cell `c` are `_prims[_begin[c], _begin[c + 1])`
+            std::vector<uint32_t> _prims;
+            std::vector<uint32_t> _large;       // tested by every ray
+            std::vector<uint32_t> _child;       // per cell, an index into `_children` or `none`
+            std::vector<Grid> _children;
+
+        public:
+            Grid() = default;
+
+            explicit Grid(std::span<Bounds const> prims, Settings const& settings = {})
+                : _settings { settings }
+            {
+                memory::Rewind scratch;
+                auto ids = scratch.vector<uint32_t>();
+                ids.reserve(prims.size());
+
+                // median diagonal, to tell the large primitives
+                auto diagonals = scratch.vector<Num>();
+                diagonals.reserve(prims.size());
+                for (auto const& b : prims)
+                    diagonals.push_back(b.empty() ? Num(0) : b.diagonal().length());
+                auto median = Num(0);
+                if (!diagonals.empty()) {
+                    auto mid = diagonals.begin() + diagonals.size() / 2;
+                    std::ranges::nth_element(diagonals, mid);
+                    median = *mid;
+                }
+
+                for (uint32_t i = 0; i < prims.size(); ++i)
+                {
+                    if (prims[i].empty()) continue;
+                    auto d = prims[i].diagonal().length();
+                    if (median > 0 && d > Num(settings.large) * median) _large.push_back(i);
+                    else ids.push_back(i);
+                }
+
+                Bounds bounds;
+                for (auto i : ids) bounds.merge(prims[i]);
+                fill(prims, ids, bounds, 0);
+            }
+
+            auto bounds() const { return _bounds; }
+            auto resolution() const { return _resolution; }
+            auto cell_count() const { return _begin.empty() ? size_t(0) : _begin.size() - 1; }
+            auto children() const -> std::span<Grid const> { return _children; }
+
+            // Entries over all cells and children, for sizing.
+            auto references() const -> size_t
+            {
+                auto n = _prims.size() + _large.size();
+                for (auto const& c : _children) n += c.references();
+                return n;
+            }
+
+            // Memory held by the cells and children.
+            auto bytes() const -> size_t
+            {
+                auto n = (_begin.size() + _prims.size() + _large.size() + _child.size()) * sizeof(uint32_t);
+                for (auto const& c : _children) n += sizeof(Grid) + c.bytes();
+                return n;
+            }
+
+            // Closest hit along `seg`, `test(prim, seg)` returning an optional with a `t` member.
+            auto intersect(vmath::RaySegLike auto seg, auto&& test) const -> decltype(test(uint32_t(), seg))
+            {
+                decltype(test(uint32_t(), seg)) closest;
+                auto visit = [&](uint32_t prim, auto& s) {
+                    if (auto q = test(prim, s)) {
+                        closest = q;
+                        s.t_max = q->t;
+                    }
+                    return false;
+                };
+                for (auto prim : _large) visit(prim, seg);
+                traverse(seg, visit);
+                return closest;
+            }
+
+            auto occluded(vmath::RaySegLike auto seg, auto&& test) const -> bool
+            {
+                auto visit = [&](uint32_t prim, auto const& s) { return bool(test(prim, s)); };
+                for (auto prim : _large)
+                    if (visit(prim, seg)) return true;
+                return traverse(seg, visit);
+            }
+
+        private:
+            // Sizes the cells to `bounds` and fills them with `ids`, splitting full cells on the first level.
+            void fill(std::span<Bounds const> prims, std::span<uint32_t const> ids, Bounds const& bounds, int level)
+            {
+                if (ids.empty() || bounds.empty()) return;
+                _bounds = bounds;
+
+                // cells of equal size in every direction, thin axes get at least one
+                auto extent = bounds.diagonal();
+                auto longest = std::max({ extent.x, extent.y, extent.z });
+                auto floor = longest * Num(1e-3);
+                auto volume = std::max(extent.x, floor) * std::max(extent.y, floor) * std::max(extent.z, floor);
+                auto size = std::cbrt(volume / (Num(_settings.density) * ids.size()));
+                for (auto a = 0; a < 3; ++a)
+                {
+                    auto n = size > 0 ? int(std::ceil(extent[a] / size)) : 1;
+                    _resolution[a] = std::clamp(n, 1, _settings.max_resolution);
+                    _cell_size[a] = extent[a] > 0 ? extent[a] / _resolution[a] : Num(1);
+                }
+                auto cells = size_t(_resolution[0]) * _resolution[1] * _resolution[2];
+
+                // count, prefix sum, then fill
+                _begin.assign(cells + 1, 0);
+                for (auto i : ids)
+                    for_cells(prims[i], [&](size_t c) { ++_begin[c + 1]; });
+                for (size_t c = 0; c < cells; ++c) _begin[c + 1] += _begin[c];
+
+                _prims.resize(_begin[cells]);
+                memory::Rewind scratch;
+                auto next = scratch.vector<uint32_t>();
+                next.assign(_begin.begin(), _begin.end() - 1);
+                for (auto i : ids)
+                    for_cells(prims[i], [&](size_t c) { _prims[next[c]++] = i; });
+
+                if (!_settings.two_level || level > 0) return;
+
+                _child.assign(cells, none);
+                for (size_t c = 0; c < cells; ++c)
+                {
+                    auto count = _begin[c + 1] - _begin[c];
+                    if (count <= _settings.max_cell) continue;
+                    // a cell of many equal primitives would only split into cells just like it
+                    if (count == ids.size()) continue;
+
+                    _child[c] = uint32_t(_children.size());
+                    auto& child = _children.emplace_back();
+                    child._settings = _settings;
+                    child.fill(prims, std::span { _prims }.subspan(_begin[c], count), cell_bounds(c), level + 1);
+                }
+            }
+
+            auto cell_of(Num v, int a) const
+            {
+                return std::clamp(int((v - _bounds.lo[a]) / _cell_size[a]), 0, _resolution[a] - 1);
+            }
+
+            auto index(int x, int y, int z) const { return (size_t(z) * _resolution[1] + y) * _resolution[0] + x; }
+
+            void for_cells(Bounds const& b, auto&& f) const
+            {
+                std::array<int, 3> lo, hi;
+                for (auto a = 0; a < 3; ++a) {
+                    lo[a] = cell_of(std::max(b.lo[a], _bounds.lo[a]), a);
+                    hi[a] = cell_of(std::min(b.hi[a], _bounds.hi[a]), a);
+                }
+                for (auto z = lo[2]; z <= hi[2]; ++z)
+                    for (auto y = lo[1]; y <= hi[1]; ++y)
+                        for (auto x = lo[0]; x <= hi[0]; ++x)
+                            f(index(x, y, z));
+            }
+
+            auto cell_bounds(size_t c) const -> Bounds
+            {
+                auto x = int(c % _resolution[0]), y = int(c / _resolution[0] % _resolution[1]), z = int(c / (size_t(_resolution[0]) * _resolution[1]));
+                Loc lo {
+                    _bounds.lo.x + x * _cell_size[0],
+                    _bounds.lo.y + y * _cell_size[1],
+                    _bounds.lo.z + z * _cell_size[2],
+                };
+                Loc hi {
+                    x + 1 == _resolution[0] ? _bounds.hi.x : lo.x + _cell_size[0],
+                    y + 1 == _resolution[1] ? _bounds.hi.y : lo.y + _cell_size[1],
+                    z + 1 == _resolution[2] ? _bounds.hi.z : lo.z + _cell_size[2],
+                };
+                return { lo, hi };
+            }
+
+            // `visit(prim, seg)` may shrink `seg.t_max`, returning true ends the traversal.
+            auto traverse(auto& seg, auto&& visit) const -> bool
+            {
+                if (_begin.empty()) return false;
+
+                using RNum = typename std::remove_cvref_t<decltype(seg)>::Num;
+                auto const& r = seg.ray;
+                constexpr auto inf = std::numeric_limits<RNum>::infinity();
+
+                // clip to the grid, widened like a BVH box test
+                auto t0 = seg.t_min, t1 = seg.t_max;
+                std::array<RNum, 3> inv;
+                for (auto a = 0; a < 3; ++a)
+                {
+                    inv[a] = 1 / r.direction[a];
+                    auto near = (RNum(_bounds.lo[a]) - r.origin[a]) * inv[a];
+                    auto far = (RNum(_bounds.hi[a]) - r.origin[a]) * inv[a];
+                    if (near > far) std::swap(near, far);
+                    far *= 1 + 2 * common::gamma<RNum>(3);
+                    t0 = near > t0 ? near : t0;
+                    t1 = far < t1 ? far : t1;
+                    if (t0 > t1) return false;
+                }
+
+                // the cell the ray enters in, and when it crosses into the next one along each axis
+                std::array<int, 3> cell, step, out;
+                std::array<RNum, 3> next, delta;
+                for (auto a = 0; a < 3; ++a)
+                {
+                    cell[a] = cell_of(Num(r.origin[a] + t0 * r.direction[a]), a);
+                    auto d = r.direction[a];
+                    if (d > 0) {
+                        next[a] = (RNum(_bounds.lo[a] + (cell[a] + 1) * _cell_size[a]) - r.origin[a]) * inv[a];
+                        delta[a] = RNum(_cell_size[a]) * inv[a];
+                        step[a] = 1;
+                        out[a] = _resolution[a];
+                    } else if (d < 0) {
+                        next[a] = (RNum(_bounds.lo[a] + cell[a] * _cell_size[a]) - r.origin[a]) * inv[a];
+                        delta[a] = -RNum(_cell_size[a]) * inv[a];
+                        step[a] = -1;
+                        out[a] = -1;
+                    } else {
+                        next[a] = inf;
+                        delta[a] = inf;
+                        step[a] = 0;
+                        out[a] = -1;
+                    }
+                }
+
+                // primitives spanning several cells are only tested once while they stay in here
+                std::array<uint32_t, 8> mailbox;
+                mailbox.fill(none);
+                size_t mail = 0;
+
+                while (true)
+                {
+                    auto axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+                    auto exit = std::min(next[axis], t1);
+                    auto c = index(cell[0], cell[1], cell[2]);
+
+                    if (!_child.empty() && _child[c] != none) {
+                        if (_children[_child[c]].traverse(seg, visit)) return true;
+                    } else {
+                        for (auto i = _begin[c]; i < _begin[c + 1]; ++i)
+                        {
+                            auto prim = _prims[i];
+                            if (std::ranges::find(mailbox, prim) != mailbox.end()) continue;
+                            mailbox[mail++ % mailbox.size()] = prim;
+                            if (visit(prim, seg)) return true;
+                        }
+                    }
+
+                    // a hit before the cell ends can not be beaten by a later cell
+                    if (seg.t_max <= exit || next[axis] > t1) return false;
+                    cell[axis] += step[axis];
+                    if (cell[axis] == out[axis]) return false;
+                    next[axis] += delta[axis];
+                }
+            }
+    };
+}
+
+namespace object
+{
+    // A `HittableList` that finds hits through a `grid::Grid`.
+    template<WorldLike TWorld>
+    using GridList = AcceleratedList<TWorld, grid::Grid<typename TWorld::Num>>;
+}
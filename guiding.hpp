@@ -0,0 +1,431 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "owrt.hpp"
+
+/*
+Path guiding with an SD-tree (Mueller et al. 2017, "Practical Path Guiding"):
+    - A binary spatial tree over the scene, each leaf holding a quadtree over directions
+      that learns where incident radiance comes from
+    - Directions map to the unit square by cylindrical coordinates (cos theta, phi),
+      which preserves area, so a density on the square is a density on the sphere
+    - Diffuse vertices mix sampling the quadtree with sampling the bsdf, weighted by
+      the combined density, so the estimate stays unbiased however poorly it has learned
+    - Trained over the progressive passes: a pass records into the `building` trees and
+      samples from the `sampling` trees, `merge` then refines both. The main loop's passes
+      are all the same size, so unlike the paper's doubling passes the trees keep what they
+      learned and only their structure is adapted
+    - Records are collected per row and merged in row order, so results do not depend on threading
+*/
+namespace guiding
+{
+    struct Settings
+    {
+        float guide_fraction = 0.5;         // share of directions drawn from the guide
+        float spatial_threshold = 4000;     // leaf samples before a split
+        float flux_threshold = 0.01;        // share of a quadtree's energy before a quadrant splits
+        int max_depth = 20;
+    };
+
+    // Unit direction <-> unit square, area preserving.
+    template<typename TVec>
+    constexpr auto to_square(TVec const& d) -> std::pair<typename TVec::Num, typename TVec::Num>
+    {
+        using Num = typename TVec::Num;
+        auto phi = std::atan2(d.y, d.x);
+        if (phi < 0) phi += Num(2 * common::pi);
+        return { std::clamp((d.z + 1) / 2, Num(0), Num(1)), std::clamp(phi / Num(2 * common::pi), Num(0), Num(1)) };
+    }
+
+    template<typename TVec>
+    constexpr auto from_square(typename TVec::Num u, typename TVec::Num v) -> TVec
+    {
+        using Num = typename TVec::Num;
+        auto z = 2 * u - 1;
+        auto r = std::sqrt(std::max(Num(0), 1 - z * z));
+        auto phi = Num(2 * common::pi) * v;
+        return TVec { r * std::cos(phi), r * std::sin(phi), z };
+    }
+
+    // Quadtree over the unit square; a quadrant is a leaf while its child index is zero.
+    class DTree
+    {
+        public:
+            struct Node
+            {
+                std::array<float, 4> energy {};
+                std::array<uint32_t, 4> child {};
+            };
+
+            std::vector<Node> nodes { Node {} };
+
+            auto total() const -> float { return sum(nodes[0]); }
+
+            // The leaf quadrant holding (u, v), as node index * 4 + quadrant.
+            auto bin(float u, float v) const -> uint32_t
+            {
+                uint32_t n = 0;
+                while (true)
+                {
+                    auto q = quadrant(u, v);
+                    if (!nodes[n].child[q]) return n * 4 + q;
+                    n = nodes[n].child[q];
+                }
+            }
+
+            // Density over the unit square.
+            auto pdf(float u, float v) const -> float
+            {
+                float p = 1;
+                uint32_t n = 0;
+                while (true)
+                {
+                    auto const& node = nodes[n];
+                    auto s = sum(node);
+                    if (s <= 0) return 0;
+                    auto q = quadrant(u, v);
+                    p *= 4 * node.energy[q] / s;
+                    if (!node.child[q]) return p;
+                    n = node.child[q];
+                }
+            }
+
+            // Picks a point proportional to energy, first the column then the row at each level.
+            auto sample(float u1, float u2) const -> std::pair<float, float>
+            {
+                float x = 0, y = 0, size = 1;
+                uint32_t n = 0;
+                while (true)
+                {
+                    auto const& e = nodes[n].energy;
+                    auto left = e[0] + e[2], right = e[1] + e[3];
+                    auto qx = pick(u1, left, right);
+                    auto qy = pick(u2, e[qx], e[qx + 2]);
+                    auto q = qx + 2 * qy;
+
+                    size /= 2;
+                    x += qx * size;
+                    y += qy * size;
+                    if (!nodes[n].child[q])
+                        return { x + u1 * size, y + u2 * size };
+                    n = nodes[n].child[q];
+                }
+            }
+
+            // Restores the energy of inner quadrants from their children, after recording into leaves.
+            void accumulate() { accumulate(0); }
+
+            // Same energy as `other`, in quadrants subdivided where they hold more than `threshold`
+            // of it and merged where they hold less. New quadrants split their parent's energy evenly.
+            static auto refined(DTree const& other, float threshold, int max_depth) -> DTree
+            {
+                DTree tree;
+                auto total = other.total();
+                if (total <= 0) return other;
+
+                struct Item { uint32_t node; int64_t other; float energy; int depth; };
+                std::vector<Item> stack { Item { 0, 0, total, 1 } };
+                while (!stack.empty())
+                {
+                    auto [n, o, energy, depth] = stack.back();
+                    stack.pop_back();
+
+                    for (auto q = 0; q < 4; ++q)
+                    {
+                        auto e = o >= 0 ? other.nodes[o].energy[q] : energy / 4;
+                        tree.nodes[n].energy[q] = e;
+                        if (e / total <= threshold || depth >= max_depth) continue;
+
+                        auto c = uint32_t(tree.nodes.size());
+                        tree.nodes[n].child[q] = c;
+                        tree.nodes.emplace_back();
+                        auto oc = o >= 0 && other.nodes[o].child[q] ? int64_t(other.nodes[o].child[q]) : int64_t(-1);
+                        stack.push_back({ c, oc, e, depth + 1 });
+                    }
+                }
+                return tree;
+            }
+
+            void scale(float f)
+            {
+                for (auto& n : nodes)
+                    for (auto& e : n.energy) e *= f;
+            }
+
+        private:
+            static auto sum(Node const& n) -> float { return n.energy[0] + n.energy[1] + n.energy[2] + n.energy[3]; }
+
+            // Which quadrant (u, v) is in, rescaling both into it.
+            static auto quadrant(float& u, float& v) -> uint32_t
+            {
+                uint32_t q = 0;
+                if (u >= 0.5f) { q |= 1; u -= 0.5f; }
+                if (v >= 0.5f) { q |= 2; v -= 0.5f; }
+                u *= 2; v *= 2;
+                return q;
+            }
+
+            // Chooses between two weights with `u`, rescaling it into the chosen part.
+            static auto pick(float& u, float a, float b) -> uint32_t
+            {
+                auto s = a + b;
+                auto split = s > 0 ? a / s : 0.5f;
+                if (u < split) { u = split > 0 ? u / split : 0; return 0; }
+                u = std::min((u - split) / (1 - split), std::nextafter(1.f, 0.f));
+                return 1;
+            }
+
+            auto accumulate(uint32_t n) -> float
+            {
+                for (auto q = 0; q < 4; ++q)
+                    if (nodes[n].child[q])
+                        nodes[n].energy[q] = accumulate(nodes[n].child[q]);
+                return sum(nodes[n]);
+            }
+    };
+
+    template<std::floating_point TNum>
+    class SDTree
+    {
+        public:
+            using Num = TNum;
+            using Loc = vmath::Loc3<Num>;
+            using Vec = vmath::Vec3<Num>;
+            using Bounds = vmath::Bounds3<Num>;
+
+            struct Leaf
+            {
+                DTree sampling;
+                DTree building;
+                uint64_t samples = 0;
+            };
+
+            // Deposit into the building quadtree of a leaf, key is leaf << 32 | bin.
+            struct Record
+            {
+                uint64_t key;
+                float value;
+                uint32_t count;
+            };
+            using Records = std::vector<Record>;
+
+        private:
+            struct Node
+            {
+                uint32_t child = 0;     // second child follows the first, zero for leaves
+                uint32_t leaf = 0;
+                int axis = 0;
+                Num split = 0;
+            };
+
+            Settings _settings;
+            Bounds _bounds;
+            std::vector<Node> _nodes { Node {} };
+            std::vector<Leaf> _leaves { Leaf {} };
+            std::vector<Records> _rows;
+            int _pass = 0;
+
+        public:
+            explicit SDTree(Bounds const& bounds, Settings const& settings = {})
+                : _settings { settings }, _bounds { bounds }
+            { }
+
+            auto settings() const -> Settings const& { return _settings; }
+            auto leaf_count() const { return _leaves.size(); }
+
+            auto leaf_at(Loc const& p) const -> uint32_t
+            {
+                uint32_t n = 0;
+                while (_nodes[n].child)
+                    n = _nodes[n].child + (p[_nodes[n].axis] < _nodes[n].split ? 0 : 1);
+                return _nodes[n].leaf;
+            }
+
+            auto leaf(uint32_t i) const -> Leaf const& { return _leaves[i]; }
+
+            void begin_pass(size_t rows)
+            {
+                _rows.resize(rows);
+                for (auto& r : _rows) r.clear();
+            }
+
+            auto row(size_t j) -> Records& { return _rows[j]; }
+
+            // Folds the finished pass in, then refines the spatial tree and the quadtrees.
+            void merge()
+            {
+                for (auto const& row : _rows)
+                    for (auto const& r : row)
+                    {
+                        auto& leaf = _leaves[r.key >> 32];
+                        auto bin = uint32_t(r.key);
+                        leaf.building.nodes[bin / 4].energy[bin % 4] += r.value;
+                        leaf.samples += r.count;
+                    }
+                for (auto& leaf : _leaves)
+                    leaf.building.accumulate();
+
+                // samples per leaf grow with the passes, and so does what a leaf has to hold
+                ++_pass;
+                auto threshold = uint64_t(_settings.spatial_threshold * std::sqrt(Num(_pass)));
+                split_leaves(0, _bounds, threshold);
+
+                for (auto& leaf : _leaves)
+                {
+                    if (leaf.building.total() > 0)
+                        leaf.sampling = leaf.building;
+                    leaf.building = DTree::refined(leaf.building, _settings.flux_threshold, _settings.max_depth);
+                }
+            }
+
+        private:
+            void split_leaves(uint32_t n, Bounds const& box, uint64_t threshold)
+            {
+                if (!_nodes[n].child) {
+                    auto& leaf = _leaves[_nodes[n].leaf];
+                    if (leaf.samples <= threshold) return;
+
+                    // both halves start from the parent's quadtrees with half its samples and energy
+                    leaf.samples /= 2;
+                    leaf.building.scale(0.5f);
+                    auto axis = box.major_axis();
+                    auto split = box.centroid()[axis];
+                    auto first = uint32_t(_nodes.size());
+                    auto second_leaf = uint32_t(_leaves.size());
+                    _leaves.push_back(leaf);
+                    _nodes.push_back({ 0, _nodes[n].leaf });
+                    _nodes.push_back({ 0, second_leaf });
+                    _nodes[n] = { first, 0, axis, split };
+                }
+
+                auto [lower, upper] = halves(box, _nodes[n].axis, _nodes[n].split);
+                auto first = _nodes[n].child;
+                split_leaves(first, lower, threshold);
+                split_leaves(first + 1, upper, threshold);
+            }
+
+            static auto halves(Bounds const& box, int axis, Num split) -> std::pair<Bounds, Bounds>
+            {
+                auto lower = box, upper = box;
+                auto set = [&](Loc& p) { (axis == 0 ? p.x : axis == 1 ? p.y : p.z) = split; };
+                set(lower.hi);
+                set(upper.lo);
+                return { lower, upper };
+            }
+    };
+
+    // The guided half of a vertex's directional sampling, or nothing where the guide has not learned yet.
+    template<typename TVec>
+    struct Mixture
+    {
+        using Num = typename TVec::Num;
+
+        DTree const* tree = nullptr;
+        Num fraction = 0;
+
+        constexpr explicit operator bool() const { return tree; }
+
+        // Solid angle density of the guide alone.
+        auto guide_pdf(TVec const& wi) const -> Num
+        {
+            auto [u, v] = to_square(wi);
+            return Num(tree->pdf(float(u), float(v))) / Num(4 * common::pi);
+        }
+
+        // Density of picking `wi` with the mixture, given the bsdf's own density for it.
+        auto pdf(Num bsdf_pdf, TVec const& wi) const -> Num
+        {
+            if (!tree) return bsdf_pdf;
+            return (1 - fraction) * bsdf_pdf + fraction * guide_pdf(wi);
+        }
+
+        auto sample(Num u1, Num u2) const -> TVec
+        {
+            auto [u, v] = tree->sample(float(u1), float(u2));
+            return from_square<TVec>(Num(u), Num(v));
+        }
+    };
+
+    // Collects the guided vertices of one path at a time into the records of one row.
+    template<class TTree, typename TColor>
+    class PathRecorder
+    {
+        public:
+            using Num = typename TTree::Num;
+            using Vec = typename TTree::Vec;
+            using Color = TColor;
+            using ColorNum = typename Color::Num;
+            using Records = typename TTree::Records;
+
+        private:
+            struct Vertex
+            {
+                uint64_t key;
+                Num pdf;            // density the direction was drawn with
+                Color before;       // radiance gathered up to and including the vertex's own light sample
+                Color throughput;   // path weight leaving the vertex along the direction
+            };
+
+            TTree const& _tree;
+            Records& _records;
+            std::array<Vertex, 16> _vertices;
+            size_t _count = 0;
+
+        public:
+            PathRecorder(TTree const& tree, Records& records)
+                : _tree { tree }, _records { records }
+            { }
+
+            auto tree() const -> TTree const& { return _tree; }
+
+            // Whether the vertex was kept.
+            auto add(uint32_t leaf, Vec const& wi, Num pdf, Color const& before, Color const& throughput) -> bool
+            {
+                if (_count == _vertices.size() || pdf <= 0) return false;
+                auto [u, v] = to_square(wi);
+                auto bin = _tree.leaf(leaf).building.bin(float(u), float(v));
+                _vertices[_count++] = { uint64_t(leaf) << 32 | bin, pdf, before, throughput };
+                return true;
+            }
+
+            // Leaves radiance the path gathered right after the last vertex out of what it learns.
+            void exclude_last(Color const& radiance)
+            {
+                if (_count) _vertices[_count - 1].before += radiance;
+            }
+
+            // Deposits the radiance that arrived along each direction over the density it was drawn with.
+            void finish(Color const& radiance)
+            {
+                for (auto const& v : std::span { _vertices.data(), _count })
+                {
+                    auto d = radiance - v.before;
+                    auto over = [](ColorNum a, ColorNum t) { return t > 0 ? a / t : ColorNum(0); };
+                    auto incident = color::luminance(Color { over(d.r, v.throughput.r), over(d.g, v.throughput.g), over(d.b, v.throughput.b) });
+                    _records.push_back({ v.key, float(incident / v.pdf), 1 });
+                }
+                _count = 0;
+            }
+
+            // Sums records of the same bin, so a row hands over one record per bin it touched.
+            void compact()
+            {
+                std::ranges::sort(_records, {}, &TTree::Record::key);
+                size_t out = 0;
+                for (size_t i = 0; i < _records.size(); ++i)
+                {
+                    if (out > 0 && _records[out - 1].key == _records[i].key) {
+                        _records[out - 1].value += _records[i].value;
+                        _records[out - 1].count += _records[i].count;
+                    } else {
+                        _records[out++] = _records[i];
+                    }
+                }
+                _records.resize(out);
+            }
+    };
+}
@@ -2,8 +2,11 @@
 
 #include <vector>
 #include <optional>
+#include <cstdint>
+#include <algorithm>
 
 #include "ray.hpp"
+#include "bounds.hpp"
 
 namespace object
 {
@@ -16,11 +19,12 @@ namespace object
         using Num = typename World::Num;
         using Loc = typename World::Loc;
         using Vec = typename World::Vec;
-        using MatVar = typename World::MatVar;
+        using Ray = typename World::Ray;
 
         Loc point;
         Vec normal;
-        MatVar const* material = nullptr;
+        Vec error; // absolute error bound on `point`
+        Handle material; // into the world's `materials`
         Num t;
         bool front_face;
 
@@ -29,11 +33,33 @@ namespace object
             front_face = dot(r.direction, outward_normal) < 0;
             normal = front_face ? outward_normal : -outward_normal;
         }
+
+        // A ray leaving the surface along `direction`, safe to trace from t = 0.
+        constexpr auto spawn_ray(Vec const& direction) const
+        {
+            return Ray { offset_ray_origin(point, error, normal, direction), direction };
+        }
+    };
+
+    // What traversal keeps per candidate: enough to pick the closest hit and to
+    // build its `HitRecord` afterwards with `surface`.
+    template<WorldLike TWorld>
+    struct HitQuery
+    {
+        using Num = typename TWorld::Num;
+
+        Num t;
+        uint32_t prim = 0; // index of the object within its aggregate
+        uint32_t sub = 0;  // object local primitive id
+        uint32_t inst = 0; // object within an instance's prototype
     };
 
     template<typename T, typename TWorld=T::World>
     concept Hittable = WorldLike<TWorld> and std::same_as<TWorld, typename T::World>
-        and requires (T h, vmath::RaySegment<typename TWorld::Num> seg) {
+        and requires (T h, vmath::RaySegment<typename TWorld::Num> seg, HitQuery<TWorld> q) {
+            { h.intersect(seg) } -> std::convertible_to<std::optional<HitQuery<TWorld>>>;
+            { h.occluded(seg) } -> std::convertible_to<bool>;
+            { h.surface(seg.ray, q) } -> std::convertible_to<HitRecord<TWorld>>;
             { h.hit(seg) } -> std::convertible_to<std::optional<HitRecord<TWorld>>>;
         };
 
@@ -48,10 +74,13 @@ namespace object
     {
         using World = TWorld;
         using ObjVar = typename TWorld::ObjVar;
+        using MatTables = typename TWorld::MatTables;
         using Ray = typename TWorld::Ray;
         using HitRec = HitRecord<TWorld>;
+        using Query = HitQuery<TWorld>;
 
         std::vector<ObjVar> objects;
+        MatTables materials;    // what the objects' handles refer to
 
         template<template<class> typename THittable>
         constexpr void add(THittable<TWorld>&& hittable)
@@ -59,24 +88,129 @@ namespace object
             objects.emplace_back(std::forward<THittable<TWorld>&&>(hittable));
         }
 
-        constexpr auto hit(vmath::RaySegLike auto seg) const
+        constexpr auto intersect(vmath::RaySegLike auto seg) const
         {
-            std::optional<HitRec> rec;
+            std::optional<Query> closest;
 
-            for (const auto& object : objects)
+            for (uint32_t i = 0; i < objects.size(); ++i)
             {
-                auto hit = std::visit([&](auto&& o) { return o.hit(seg); }, object)
-                    //.and_then([&](auto const& hit) { seg.t_max = hit.t; return hit; })
-                    //.or_else(*rec)
-                    ;
-                // TODO temp untill full c++23
-                if (hit) {
-                    rec = hit;
-                    seg.t_max = rec->t;
+                auto q = std::visit([&](auto&& o) { return o.intersect(seg); }, objects[i]);
+                if (q) {
+                    closest = Query { q->t, i, q->sub, q->inst };
+                    seg.t_max = q->t;
                 }
             }
 
-            return rec;
+            return closest;
+        }
+
+        // Any hit at all within the segment, for shadow rays.
+        constexpr auto occluded(vmath::RaySegLike auto seg) const -> bool
+        {
+            return std::ranges::any_of(objects, [&](auto const& object) {
+                return std::visit([&](auto&& o) { return o.occluded(seg); }, object);
+            });
+        }
+
+        constexpr auto surface(Ray const& r, Query const& q) const -> HitRec
+        {
+            return std::visit([&](auto&& o) { return o.surface(r, q); }, objects[q.prim]);
+        }
+
+        constexpr auto hit(vmath::RaySegLike auto seg) const -> std::optional<HitRec>
+        {
+            if (auto q = intersect(seg); q)
+                return surface(seg.ray, *q);
+            return std::nullopt;
+        }
+
+        // Memory held by the list and the tables its objects keep on the side, each table
+        // counted once; meshes and prototypes behind shared pointers are not counted.
+        auto object_bytes() const -> size_t
+        {
+            size_t bytes = objects.capacity() * sizeof(ObjVar);
+            std::vector<void const*> tables;
+            for (auto const& object : objects)
+                std::visit([&](auto&& o) {
+                    if constexpr (requires { o.table->bytes(); })
+                        if (std::ranges::find(tables, o.table.get()) == tables.end()) {
+                            tables.push_back(o.table.get());
+                            bytes += o.table->bytes();
+                        }
+                }, object);
+            return bytes;
+        }
+
+        constexpr auto bounds() const
+        {
+            vmath::Bounds3<typename TWorld::Num> b;
+            for (auto const& object : objects)
+                b.merge(std::visit([](auto&& o) { return o.bounds(); }, object));
+            return b;
+        }
+    };
+
+    // A `HittableList` that finds hits through an acceleration structure over its objects'
+    // boxes, such as `bvh::Bvh` or `grid::Grid`. `build` after the last `add`; objects added
+    // later are not seen until the next `build`.
+    template<WorldLike TWorld, class TAccel>
+    struct AcceleratedList
+        : public HittableList<TWorld>
+    {
+        using Base = HittableList<TWorld>;
+        using Num = typename TWorld::Num;
+        using Query = typename Base::Query;
+        using HitRec = typename Base::HitRec;
+        using Accel = TAccel;
+
+        using Base::objects;
+
+        typename Accel::Settings settings;
+        Accel accel;
+
+        void build()
+        {
+            accel = Accel { object_bounds(), settings };
+        }
+
+        // After objects moved, follows them without building from scratch, where the structure
+        // can (`bvh::Bvh::refit`), with the settings it was built with. Objects must not have
+        // been added or removed since `build`.
+        auto refit(auto& scheduler)
+        {
+            return accel.refit(object_bounds(), scheduler);
+        }
+
+        constexpr auto intersect(vmath::RaySegLike auto seg) const -> std::optional<Query>
+        {
+            return accel.intersect(seg, [&](uint32_t i, auto const& s) -> std::optional<Query> {
+                auto q = std::visit([&](auto const& o) { return o.intersect(s); }, objects[i]);
+                if (!q) return std::nullopt;
+                return Query { q->t, i, q->sub, q->inst };
+            });
+        }
+
+        constexpr auto occluded(vmath::RaySegLike auto seg) const -> bool
+        {
+            return accel.occluded(seg, [&](uint32_t i, auto const& s) {
+                return std::visit([&](auto const& o) { return o.occluded(s); }, objects[i]);
+            });
+        }
+
+        constexpr auto hit(vmath::RaySegLike auto seg) const -> std::optional<HitRec>
+        {
+            if (auto q = intersect(seg); q)
+                return this->surface(seg.ray, *q);
+            return std::nullopt;
+        }
+
+    private:
+        auto object_bounds() const
+        {
+            std::vector<vmath::Bounds3<Num>> bounds(objects.size());
+            for (size_t i = 0; i < objects.size(); ++i)
+                bounds[i] = std::visit([](auto const& o) { return o.bounds(); }, objects[i]);
+            return bounds;
         }
     };
 }
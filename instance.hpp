@@ -0,0 +1,118 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "hittable.hpp"
+#include "bounds.hpp"
+#include "transform.hpp"
+#include "bvh.hpp"
+#include "memory.hpp"
+
+namespace object
+{
+    /*
+    Where the instances of a scene sit, their prototypes and transforms, kept out of the
+    object list: a transform and its inverse would make every object slot as large as
+    they are, spheres included, so an instance only holds this table and its place in it.
+    */
+    template<typename TWorld>
+    struct InstanceTable
+    {
+        using Num = typename TWorld::Num;
+        using Prototype = BvhList<TWorld>;
+
+        struct Placement
+        {
+            std::shared_ptr<Prototype const> prototype;
+            vmath::Transform<Num> transform;    // from the prototype's space to the world's
+        };
+
+        std::vector<Placement> placements;
+
+        // Memory of the placements; the prototypes are not counted.
+        auto bytes() const -> size_t { return placements.capacity() * sizeof(Placement); }
+    };
+
+    /*
+    One placement of a shared prototype:
+        - The prototype is a `BvhList` of its own, the bottom level; instances go into the
+          world like any other object, so the world's BVH over them is the top level
+        - Rays move into the prototype's space rather than the prototype into the world's,
+          so an instance costs a transform however much the prototype holds
+        - The prototype and transform live in an `InstanceTable`, shared by the instances
+          of a scene, so the instance itself is no larger than a sphere
+        - Prototype objects take their material handles from the world they are placed in,
+          and prototypes do not hold instances themselves
+    */
+    template<typename TWorld>
+    class Instance
+    {
+        public:
+            using World = TWorld;
+            using Num = typename World::Num;
+            using Ray = typename World::Ray;
+            using HitRec = HitRecord<World>;
+            using Query = HitQuery<World>;
+            using Table = InstanceTable<World>;
+            using Prototype = typename Table::Prototype;
+
+            memory::Shared<Table> table;
+            uint32_t index;     // of the placement in `table`
+
+            // Adds a placement of `prototype` to `table`, returning the instance for it.
+            static auto place(memory::Shared<Table> const& table, std::shared_ptr<Prototype const> prototype, vmath::Transform<Num> const& transform) -> Instance
+            {
+                table->placements.push_back({ std::move(prototype), transform });
+                return { table, uint32_t(table->placements.size() - 1) };
+            }
+
+            constexpr auto intersect(vmath::RaySegLike auto seg) const -> std::optional<Query>
+            {
+                auto const& [prototype, transform] = placement();
+                auto local = to_local(transform, seg.ray);
+                auto q = prototype->intersect(local.span(seg.t_min, seg.t_max));
+                if (!q) return std::nullopt;
+                return Query { q->t, 0, q->sub, q->prim };
+            }
+
+            constexpr auto occluded(vmath::RaySegLike auto seg) const -> bool
+            {
+                auto const& [prototype, transform] = placement();
+                auto local = to_local(transform, seg.ray);
+                return prototype->occluded(local.span(seg.t_min, seg.t_max));
+            }
+
+            // The prototype's hit moved back out. Directions are not renormalized on the way
+            // in, so `t` is the same in both spaces.
+            constexpr auto surface(Ray const& r, Query const& q) const -> HitRec
+            {
+                auto const& [prototype, transform] = placement();
+                auto rec = prototype->surface(to_local(transform, r), Query { q.t, q.inst, q.sub });
+                std::tie(rec.point, rec.error) = transform.to_world(rec.point, rec.error);
+                rec.normal = unit_vector(transform.normal_to_world(rec.normal));
+                return rec;
+            }
+
+            constexpr auto hit(vmath::RaySegLike auto seg) const -> std::optional<HitRec>
+            {
+                if (auto q = intersect(seg); q)
+                    return surface(seg.ray, *q);
+                return std::nullopt;
+            }
+
+            constexpr auto bounds() const
+            {
+                auto const& [prototype, transform] = placement();
+                return transform.to_world(prototype->bounds());
+            }
+
+            constexpr auto placement() const -> typename Table::Placement const& { return table->placements[index]; }
+
+        private:
+            static constexpr auto to_local(vmath::Transform<Num> const& transform, Ray const& r)
+            {
+                return Ray { transform.inverse(r.origin), transform.inverse(r.direction) };
+            }
+    };
+}
@@ -0,0 +1,456 @@
+#pragma once
+
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <array>
+#include <limits>
+
+#include "owrt.hpp"
+
+#include "sphere.hpp"
+#include "bounds.hpp"
+
+/*
+Explicit light sampling:
+    - Lights are the emissive objects of a scene, gathered once after it is built
+    - `choose` picks a light for a shading point and reports the probability it did so,
+      `pmf` recomputes that probability for a light the bsdf happened to hit
+    - Each light samples directions towards itself with a solid angle density
+    - `LightList` picks uniformly, `LightBVH` by each light's estimated contribution
+*/
+namespace light
+{
+    using namespace dispatch;
+
+    template<WorldLike TWorld>
+    struct LightSample
+    {
+        using Num = typename TWorld::Num;
+        using Vec = typename TWorld::Vec;
+
+        Vec wi;  // unit direction towards the light
+        Num t;   // distance along `wi` to the light's surface
+        Num pdf; // solid angle density of `wi`
+    };
+
+    template<WorldLike TWorld>
+    struct LightChoice
+    {
+        using Num = typename TWorld::Num;
+
+        uint32_t light;
+        Num pmf;
+    };
+
+    /* Light hierarchy helpers, after pbrt-v4's light BVH */
+
+    // cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines of two angles
+    template<std::floating_point TNum>
+    constexpr auto cos_sub_clamped(TNum sin_a, TNum cos_a, TNum sin_b, TNum cos_b) -> TNum
+    {
+        if (cos_a > cos_b) return 1;
+        return cos_a * cos_b + sin_a * sin_b;
+    }
+    template<std::floating_point TNum>
+    constexpr auto sin_sub_clamped(TNum sin_a, TNum cos_a, TNum sin_b, TNum cos_b) -> TNum
+    {
+        if (cos_a > cos_b) return 0;
+        return sin_a * cos_b - cos_a * sin_b;
+    }
+    template<std::floating_point TNum>
+    constexpr auto safe_sqrt(TNum x) { return std::sqrt(std::max(TNum(0), x)); }
+
+    // Where a group of lights is, how much power it has, and a cone bounding the directions it emits
+    // into: every point emits within `acos(cos_theta_e)` of some direction within `acos(cos_theta_o)` of `w`.
+    template<WorldLike TWorld>
+    struct LightBounds
+    {
+        using Num = typename TWorld::Num;
+        using Loc = typename TWorld::Loc;
+        using Vec = typename TWorld::Vec;
+        using Bounds = vmath::Bounds3<Num>;
+
+        Bounds bounds;
+        Vec w;
+        Num phi = 0;
+        Num cos_theta_o = 1;
+        Num cos_theta_e = 1;
+
+        static constexpr auto merge(LightBounds const& a, LightBounds const& b) -> LightBounds
+        {
+            if (a.phi == 0) return b;
+            if (b.phi == 0) return a;
+
+            auto [w, cos_theta_o] = merge_cones(a.w, a.cos_theta_o, b.w, b.cos_theta_o);
+            return {
+                vmath::merge(a.bounds, b.bounds), w, a.phi + b.phi,
+                cos_theta_o, std::min(a.cos_theta_e, b.cos_theta_e)
+            };
+        }
+
+        static constexpr auto merge_cones(Vec const& wa, Num cos_a, Vec const& wb, Num cos_b) -> std::pair<Vec, Num>
+        {
+            auto theta_a = std::acos(std::clamp(cos_a, Num(-1), Num(1)));
+            auto theta_b = std::acos(std::clamp(cos_b, Num(-1), Num(1)));
+            auto theta_d = std::acos(std::clamp(Num(dot(wa, wb)), Num(-1), Num(1)));
+            constexpr auto pi = Num(common::pi);
+
+            if (std::min(theta_d + theta_b, pi) <= theta_a) return { wa, cos_a };
+            if (std::min(theta_d + theta_a, pi) <= theta_b) return { wb, cos_b };
+
+            auto theta_o = (theta_a + theta_d + theta_b) / 2;
+            auto axis = cross(wa, wb);
+            if (theta_o >= pi || axis.length_squared() == 0) return { wa, Num(-1) };
+
+            // rotate wa towards wb by theta_o - theta_a (Rodrigues)
+            auto k = unit_vector(axis);
+            auto theta_r = theta_o - theta_a;
+            auto w = std::cos(theta_r) * wa + std::sin(theta_r) * cross(k, wa) + (1 - std::cos(theta_r)) * dot(k, wa) * k;
+            return { w, std::cos(theta_o) };
+        }
+
+        // Cost of a split candidate, the surface area orientation heuristic.
+        constexpr auto cost(int axis) const -> Num
+        {
+            constexpr auto pi = Num(common::pi);
+            auto theta_o = std::acos(std::clamp(cos_theta_o, Num(-1), Num(1)));
+            auto theta_e = std::acos(std::clamp(cos_theta_e, Num(-1), Num(1)));
+            auto theta_w = std::min(theta_o + theta_e, pi);
+            auto sin_theta_o = safe_sqrt(1 - cos_theta_o * cos_theta_o);
+            auto m_omega = 2 * pi * (1 - cos_theta_o)
+                + pi / 2 * (2 * theta_w * sin_theta_o - std::cos(theta_o - 2 * theta_w) - 2 * theta_o * sin_theta_o + cos_theta_o);
+
+            auto d = bounds.diagonal();
+            auto extent = d[axis];
+            auto k_r = extent > 0 ? std::max({ d.x, d.y, d.z }) / extent : Num(1);
+            return phi * m_omega * k_r * bounds.surface_area();
+        }
+
+        // Conservative estimate of the light this group sends to a surface at `p` facing `n`.
+        constexpr auto importance(Loc const& p, Vec const& n) const -> Num
+        {
+            auto pc = bounds.centroid();
+            auto dist2 = (p - pc).length_squared();
+            // keeps points close to or inside the group from dominating
+            auto d2 = std::max(dist2, bounds.diagonal().length() / 2);
+            auto wi = unit_vector(p - pc);
+
+            auto cos_theta_w = dot(w, wi);
+            auto sin_theta_w = safe_sqrt(1 - cos_theta_w * cos_theta_w);
+
+            // half angle of the bounding sphere of the group, seen from p
+            auto radius2 = bounds.diagonal().length_squared() / 4;
+            auto cos_theta_b = dist2 < radius2 ? Num(-1) : safe_sqrt(1 - radius2 / dist2);
+            auto sin_theta_b = safe_sqrt(1 - cos_theta_b * cos_theta_b);
+
+            // smallest angle between the emission cone and the direction to p
+            auto sin_theta_o = safe_sqrt(1 - cos_theta_o * cos_theta_o);
+            auto cos_theta_x = cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+            auto sin_theta_x = sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+            auto cos_theta_p = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+            if (cos_theta_p <= cos_theta_e) return 0;
+
+            // smallest angle between the normal and any direction to the group
+            auto cos_theta_i = dot(-wi, n);
+            auto sin_theta_i = safe_sqrt(1 - cos_theta_i * cos_theta_i);
+            auto cos_theta_pi = cos_sub_clamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+
+            return std::max(Num(0), phi * cos_theta_p * cos_theta_pi / d2);
+        }
+    };
+
+    template<WorldLike TWorld>
+    struct SphereLight
+    {
+        using World = TWorld;
+        using Num = typename World::Num;
+        using Loc = typename World::Loc;
+        using Vec = typename World::Vec;
+        using Color = typename World::Color;
+        using Sample = LightSample<World>;
+
+        Loc center;
+        Num radius;
+        Color emit;
+        uint32_t prim; // index of the emitting object in the scene
+
+        // 1 - cos of the half angle the sphere subtends from `p`, 0 when `p` is inside it.
+        constexpr auto cone_width(Loc const& p) const -> Num
+        {
+            auto d2 = (center - p).length_squared();
+            auto sin2_max = radius * radius / d2;
+            if (sin2_max >= 1) return 0;
+            // written as sin^2 / (1 + cos) to stay accurate for small, distant lights
+            return sin2_max / (1 + std::sqrt(1 - sin2_max));
+        }
+
+        // Uniform over the cone of directions that see the sphere.
+        constexpr auto sample(Loc const& p, Num u1, Num u2) const -> std::optional<Sample>
+        {
+            auto width = cone_width(p);
+            if (width <= 0) return std::nullopt;
+
+            auto to_center = center - p;
+            auto d = to_center.length();
+
+            auto cos_theta = 1 - u1 * width;
+            auto sin_theta = std::sqrt(std::max(Num(0), 1 - cos_theta * cos_theta));
+            auto phi = Num(2 * common::pi) * u2;
+            auto wi = vmath::from_local(Vec { sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta }, to_center / d);
+
+            auto b = dot(wi, to_center);
+            auto t = b - std::sqrt(std::max(Num(0), radius * radius - (d * d - b * b)));
+
+            return Sample { wi, t, Num(1) / (Num(2 * common::pi) * width) };
+        }
+
+        constexpr auto pdf(Loc const& p) const -> Num
+        {
+            auto width = cone_width(p);
+            return width > 0 ? Num(1) / (Num(2 * common::pi) * width) : Num(0);
+        }
+
+        constexpr auto bounds() const -> LightBounds<World>
+        {
+            auto power = color::luminance(emit) * Num(4 * common::pi) * radius * radius * Num(common::pi);
+            // a sphere emits in every direction, each point of it over a hemisphere
+            return { vmath::Bounds3<Num>::around(center, radius), Vec::Up, Num(power), Num(-1), Num(0) };
+        }
+    };
+
+    // Picks lights uniformly.
+    template<WorldLike TWorld>
+    struct LightList
+    {
+        using World = TWorld;
+        using Num = typename World::Num;
+        using Loc = typename World::Loc;
+        using Vec = typename World::Vec;
+        using Light = SphereLight<World>;
+        using Choice = LightChoice<World>;
+
+        static constexpr uint32_t none = ~uint32_t(0);
+
+        std::vector<Light> lights;
+        std::vector<uint32_t> light_of_prim; // scene object index -> light index, or `none`
+
+        static auto build(object::HittableList<World> const& world)
+        {
+            LightList result;
+            result.light_of_prim.resize(world.objects.size(), none);
+
+            for (uint32_t i = 0; i < world.objects.size(); ++i)
+                std::visit([&](auto const& o) {
+                    if constexpr (std::same_as<std::remove_cvref_t<decltype(o)>, object::Sphere<World>>)
+                        world.materials.visit(o.material, [&](auto const& m) {
+                            if constexpr (material::Emitter<std::remove_cvref_t<decltype(m)>>)
+                                if (o.radius > 0) {
+                                    result.light_of_prim[i] = result.lights.size();
+                                    result.lights.push_back(Light { o.center, o.radius, m.emit, i });
+                                }
+                        });
+                }, world.objects[i]);
+
+            return result;
+        }
+
+        constexpr auto size() const { return lights.size(); }
+        constexpr auto empty() const { return lights.empty(); }
+        constexpr auto const& operator[](uint32_t i) const { return lights[i]; }
+
+        constexpr auto choose(Loc const& p, Vec const& n, Num u) const -> std::optional<Choice>
+        {
+            if (lights.empty()) return std::nullopt;
+            auto i = std::min(uint32_t(u * lights.size()), uint32_t(lights.size() - 1));
+            return Choice { i, Num(1) / lights.size() };
+        }
+
+        constexpr auto pmf(Loc const& p, Vec const& n, uint32_t light) const -> Num
+        {
+            return Num(1) / lights.size();
+        }
+    };
+
+    /*
+    Light BVH:
+        - A binary tree over the lights of a `LightList`, each node bounding its lights' position,
+          power and emission directions
+        - `choose` descends picking children in proportion to their importance for the shading point
+        - Each light remembers its path from the root as bits, so `pmf` can replay the descent
+    */
+    template<WorldLike TWorld>
+    struct LightBVH
+        : public LightList<TWorld>
+    {
+        using World = TWorld;
+        using Base = LightList<World>;
+        using Num = typename World::Num;
+        using Loc = typename World::Loc;
+        using Vec = typename World::Vec;
+        using Bounds = LightBounds<World>;
+        using Choice = LightChoice<World>;
+
+        using Base::lights;
+
+        struct Node
+        {
+            Bounds bounds;
+            uint32_t index; // the light of a leaf, or the second child (the first follows its parent)
+            bool leaf;
+        };
+
+        // trails are stored in 64 bits, past this depth splits fall back to the median
+        static constexpr int median_depth = 32;
+        static constexpr int bucket_count = 12;
+
+        std::vector<Node> nodes;
+        std::vector<uint64_t> trail_of_light;
+
+        static auto build(object::HittableList<World> const& world)
+        {
+            LightBVH result { Base::build(world) };
+            result.trail_of_light.resize(result.lights.size());
+
+            std::vector<std::pair<Bounds, uint32_t>> items;
+            for (uint32_t i = 0; i < result.lights.size(); ++i)
+                items.emplace_back(result.lights[i].bounds(), i);
+
+            if (!items.empty())
+                result.build_nodes(items.begin(), items.end(), 0, 0);
+            return result;
+        }
+
+        constexpr auto choose(Loc const& p, Vec const& n, Num u) const -> std::optional<Choice>
+        {
+            if (nodes.empty()) return std::nullopt;
+
+            Num pmf = 1;
+            uint32_t node = 0;
+            while (!nodes[node].leaf)
+            {
+                auto c0 = node + 1, c1 = nodes[node].index;
+                auto i0 = nodes[c0].bounds.importance(p, n);
+                auto i1 = nodes[c1].bounds.importance(p, n);
+                if (i0 == 0 && i1 == 0) return std::nullopt;
+
+                auto p0 = i0 / (i0 + i1);
+                if (u < p0) {
+                    node = c0;
+                    u = std::min(u / p0, one_minus_epsilon);
+                    pmf *= p0;
+                } else {
+                    node = c1;
+                    u = std::min((u - p0) / (1 - p0), one_minus_epsilon);
+                    pmf *= 1 - p0;
+                }
+            }
+
+            if (node == 0 && nodes[0].bounds.importance(p, n) == 0) return std::nullopt;
+            return Choice { nodes[node].index, pmf };
+        }
+
+        constexpr auto pmf(Loc const& p, Vec const& n, uint32_t light) const -> Num
+        {
+            auto trail = trail_of_light[light];
+
+            Num pmf = 1;
+            uint32_t node = 0;
+            while (!nodes[node].leaf)
+            {
+                auto c0 = node + 1, c1 = nodes[node].index;
+                auto i0 = nodes[c0].bounds.importance(p, n);
+                auto i1 = nodes[c1].bounds.importance(p, n);
+                if (i0 == 0 && i1 == 0) return 0;
+
+                bool second = trail & 1;
+                pmf *= (second ? i1 : i0) / (i0 + i1);
+                node = second ? c1 : c0;
+                trail >>= 1;
+            }
+
+            if (node == 0 && nodes[0].bounds.importance(p, n) == 0) return 0;
+            return pmf;
+        }
+
+    private:
+        static constexpr auto one_minus_epsilon = Num(1) - std::numeric_limits<Num>::epsilon();
+
+        auto build_nodes(auto begin, auto end, uint64_t trail, int depth) -> uint32_t
+        {
+            auto node = uint32_t(nodes.size());
+
+            if (end - begin == 1) {
+                nodes.push_back({ begin->first, begin->second, true });
+                trail_of_light[begin->second] = trail;
+                return node;
+            }
+
+            Bounds all;
+            vmath::Bounds3<Num> centroids;
+            for (auto it = begin; it != end; ++it) {
+                all = Bounds::merge(all, it->first);
+                centroids.merge(it->first.bounds.centroid());
+            }
+
+            auto mid = depth < median_depth ? split_buckets(begin, end, all, centroids) : begin;
+            if (mid == begin || mid == end) {
+                mid = begin + (end - begin) / 2;
+                auto axis = centroids.major_axis();
+                std::nth_element(begin, mid, end, [axis](auto const& a, auto const& b) {
+                    return a.first.bounds.centroid()[axis] < b.first.bounds.centroid()[axis];
+                });
+            }
+
+            nodes.push_back({ all, 0, false });
+            build_nodes(begin, mid, trail, depth + 1);
+            auto second = build_nodes(mid, end, trail | (uint64_t(1) << depth), depth + 1);
+            nodes[node].index = second;
+            return node;
+        }
+
+        // Partitions at the cheapest bucket boundary on any axis, returns `begin` when no split helps.
+        auto split_buckets(auto begin, auto end, Bounds const& all, vmath::Bounds3<Num> const& centroids)
+        {
+            auto best_cost = std::numeric_limits<Num>::infinity();
+            int best_axis = -1, best_bucket = 0;
+
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                auto lo = centroids.lo[axis], hi = centroids.hi[axis];
+                if (hi <= lo) continue;
+
+                std::array<Bounds, bucket_count> buckets;
+                for (auto it = begin; it != end; ++it) {
+                    auto b = bucket_of(it->first.bounds.centroid()[axis], lo, hi);
+                    buckets[b] = Bounds::merge(buckets[b], it->first);
+                }
+
+                for (int split = 1; split < bucket_count; ++split)
+                {
+                    Bounds below, above;
+                    for (int b = 0; b < split; ++b) below = Bounds::merge(below, buckets[b]);
+                    for (int b = split; b < bucket_count; ++b) above = Bounds::merge(above, buckets[b]);
+
+                    auto cost = below.cost(axis) + above.cost(axis);
+                    if (cost < best_cost) {
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_bucket = split;
+                    }
+                }
+            }
+
+            if (best_axis < 0) return begin;
+            auto lo = centroids.lo[best_axis], hi = centroids.hi[best_axis];
+            return std::partition(begin, end, [&](auto const& item) {
+                return bucket_of(item.first.bounds.centroid()[best_axis], lo, hi) < best_bucket;
+            });
+        }
+
+        static auto bucket_of(Num v, Num lo, Num hi) -> int
+        {
+            return std::min(int(bucket_count * (v - lo) / (hi - lo)), bucket_count - 1);
+        }
+    };
+}
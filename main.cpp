@@ -1,17 +1,31 @@
+#include <chrono>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
 #include <variant>
 #include <functional>
 #include <algorithm>
+#include <optional>
+#include <string_view>
 
 #include "owrt.hpp"
 
 #include "sphere.hpp"
+#include "triangle.hpp"
+#include "instance.hpp"
 
 #include "camera.hpp"
+#include "light.hpp"
 
+#include "memory.hpp"
 #include "scheduler.hpp"
+#include "render.hpp"
+#include "denoise.hpp"
+#include "scenes.hpp"
+#include "golden.hpp"
+#include "scenefile.hpp"
+#include "converge.hpp"
+#include "bench.hpp"
 
 #define STBI_WRITE_NO_STDIO
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -23,6 +37,7 @@ using vmath::Ray;
 template<dispatch::WorldLike TWorld>
 using MatDispatch = material::MaterialDispatch<
     material::Absorb<TWorld>,
+    material::Emissive<TWorld>,
     material::Lambertian<TWorld>,
     material::Metal<TWorld>,
     material::Dielectric<TWorld>
@@ -30,96 +45,22 @@ using MatDispatch = material::MaterialDispatch<
 
 template<dispatch::WorldLike TWorld>
 using ObjDispatch = object::HittableDispatch<
-    object::Sphere<TWorld>
+    object::Sphere<TWorld>,
+    object::TriangleMesh<TWorld>,
+    object::Instance<TWorld>
 >;
 
-template<typename Color = Color3<double>, vmath::RayLike Ray>
-auto ray_color(Ray const& r, object::Hittable auto& world, common::RandomState& rs, int depth) -> Color
-{
-    using namespace common;
-
-    if (depth <= 0)
-        return Color::Black;
-
-    if (auto hit = world.hit(r.span(0.001, infinity)); hit)
-    {
-        auto scatter_dispatch = [&](auto&& m) { return m.scatter(r, *hit, rs); };
-        if (auto scatter = std::visit(scatter_dispatch, *hit->material); scatter)
-        {
-            return scatter->attenuation * ray_color(scatter->scattered, world, rs, depth-1);
-        }
-        return Color::Black;
-    }
-
-    constexpr auto color_top = Color::White;
-    constexpr auto color_bot = Color{0.5, 0.7, 1.0};
-
-    auto unit_direction = unit_vector(r.direction);
-    auto t = 0.5*(unit_direction.y + 1.0);
-    return mix(color_top, color_bot, t);
-}
-
 template<typename TWorld>
 struct WorldConfig
 {
     using Vec = typename TWorld::Vec;
 
-    static constexpr auto sample_sphere(Vec normal, common::RandomState& rs) { return normal + vmath::rand_in_sphere<Vec>(rs); }
-    static constexpr auto sample_unit_vector(Vec normal, common::RandomState& rs) { return normal + vmath::rand_unit_vector<Vec>(rs); }
-    static constexpr auto sample_hemisphere(Vec normal, common::RandomState& rs) { return vmath::rand_in_hemisphere<Vec>(normal, rs); }
-    static constexpr auto lambertian_sampler(Vec normal, common::RandomState& rs) { return sample_hemisphere(normal, rs); }
-};
-
-template<class World>
-void random_scene(object::HittableList<World>& world) {
-    using Num = typename World::Num;
-    using Loc = typename World::Loc;
-    using Color = typename World::Color;
+    // Swap for vmath::UniformHemisphere to compare, materials weight by whatever density it reports.
+    using LambertianSampler = vmath::CosineHemisphere<Vec>;
 
-    using Lambertian = material::Lambertian<World>;
-    using Metal = material::Metal<World>;
-    using Dielectric = material::Dielectric<World>;
-
-    common::RandomState rs;
-
-    auto ground_material = Lambertian{{0.5, 0.5, 0.5}};
-    world.template add<object::Sphere>({{0,-1000,0}, 1000, ground_material});
-
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto choose_mat = rand<Num>(rs);
-            Loc center { a + 0.6*rand<Num>(rs), 0.2, b + 0.6*rand<Num>(rs) };
-
-            if ((center - Loc{4, 0.2, 0}).length() > 0.9) {
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    auto albedo = rand<Color>(rs) * rand<Color>(rs);
-                    auto sphere_material = Lambertian{ albedo };
-                    world.template add<object::Sphere>({center, 0.2, sphere_material});
-                } else if (choose_mat < 0.95) {
-                    // metal
-                    auto albedo = rand<Color>(rs, 0.5, 1);
-                    auto fuzz = rand<Num>(rs, 0, 0.5);
-                    auto sphere_material = Metal{albedo, fuzz};
-                    world.template add<object::Sphere>({center, 0.2, sphere_material});
-                } else {
-                    // glass
-                    auto sphere_material = Dielectric{1.5};
-                    world.template add<object::Sphere>({center, 0.2, sphere_material});
-                }
-            }
-        }
-    }
-
-    auto material1 = Dielectric{1.5};
-    world.template add<object::Sphere>({{0, 1, 0}, 1.0, material1});
-
-    auto material2 = Lambertian{{0.4, 0.2, 0.1}};
-    world.template add<object::Sphere>({{-4, 1, 0}, 1.0, material2});
-
-    auto material3 = Metal{{0.7, 0.6, 0.5}, 0.0};
-    world.template add<object::Sphere>({{4, 1, 0}, 1.0, material3});
-}
+    // sampler::Independent for uncorrelated reference renders.
+    using PixelSampler = sampler::Sobol;
+};
 
 template<typename... TArgs>
 void invoke_function(void* ptr, TArgs... args)
@@ -127,96 +68,167 @@ void invoke_function(void* ptr, TArgs... args)
     (*static_cast<std::function<void(TArgs...)>*>(ptr))(args...);
 }
 
-auto main() -> int
+struct ThreadLocal {
+};
+
+auto main(int argc, char** argv) -> int
 {
     // Types
-    using Num = double;
-    using ColorNum = double;
+    using Num = float;
+    using ColorNum = float;
 
     using World = dispatch::World<
         Num, ColorNum,
         WorldConfig,
         MatDispatch, ObjDispatch>;
 
-    // weird that one of these is needed...
-    using Vec = typename World::Vec;
-    using Loc = typename World::Loc;
     using Color = typename World::Color;
 
-    // Image
+    // Modes
 
-    constexpr auto aspect_ratio = 16.0 / 9.0;
-    constexpr int image_width = 800;
-    constexpr int image_height = static_cast<int>(image_width / aspect_ratio);
-    constexpr int samples_per_pixel = 100;
-    constexpr int max_depth = 50;
+    std::string_view mode = argc > 1 ? argv[1] : "";
+    if (mode == "--golden" || mode == "--golden-update")
+    {
+        auto failures = golden::run<World, ThreadLocal>("golden", mode == "--golden-update");
+        std::cerr << (failures ? "Golden images differ." : "Golden images match.") << "\n";
+        return failures ? 1 : 0;
+    }
+    if (mode == "--converge")
+    {
+        scheduler::Scheduler<12, ThreadLocal> scheduler;
+        converge::run<World>(scheduler);
+        return 0;
+    }
+    if (mode == "--bench")
+    {
+        scheduler::Scheduler<12, ThreadLocal> scheduler;
+        bench::run<World>(scheduler);
+        return 0;
+    }
+    if (mode == "--animate")
+    {
+        scheduler::Scheduler<12, ThreadLocal> scheduler;
+        bench::animate<World>(scheduler);
+        return 0;
+    }
+    if (mode == "--thumbnails")
+    {
+        scheduler::Scheduler<12, ThreadLocal> scheduler;
+        bench::thumbnails<World>(scheduler);
+        return 0;
+    }
 
-    constexpr int samples_per_iter = 10;
+    std::vector<std::string_view> const flags(argv + 1, argv + argc);
+    auto has_flag = [&](std::string_view f) { return std::ranges::find(flags, f) != flags.end(); };
+    auto flag_value = [&](std::string_view f) -> std::optional<std::string_view> {
+        auto it = std::ranges::find(flags, f);
+        if (it == flags.end() || it + 1 == flags.end()) return std::nullopt;
+        return *(it + 1);
+    };
+    bool const denoise = has_flag("--denoise");
+    bool const use_cache = has_flag("--cache");
+    bool const use_guiding = has_flag("--guide");
+    bool const use_caustics = has_flag("--caustics");
+
+    // World and image
+
+    object::BvhList<World> world;
+    auto const scene_path = flag_value("--scene");
+    auto load_start = std::chrono::steady_clock::now();
+
+    // With `--generate`, a procedural scene is built instead, `--objects 2000000`,
+    // `--density`, `--palette`, `--seed` and `--mix` shaping it.
+    generate::Settings generated { .instances = has_flag("--instances") };
+
+    // A scene file brings its own settings, a config file and then `--width 320`,
+    // `--samples-per-iter 4` and the like override them. Anything else on the command
+    // line is an error rather than ignored, so a misspelt setting is not lost.
+    auto configure = [&](render::Settings s) {
+        constexpr std::string_view switches[] = { "--denoise", "--cache", "--guide", "--caustics", "--generate", "--instances", "--memory" };
+        constexpr std::string_view paths[] = { "--scene", "--write-scene", "--config" };
+        auto one_of = [](auto const& names, std::string_view f) { return std::ranges::find(names, f) != std::ranges::end(names); };
+
+        if (auto config = flag_value("--config")) s.read(std::string(*config));
+        for (size_t i = 0; i < flags.size(); ++i)
+        {
+            auto flag = flags[i];
+            if (one_of(switches, flag)) continue;
+            if (!flag.starts_with("--")) throw std::invalid_argument("unexpected argument '" + std::string(flag) + "'");
+            if (i + 1 == flags.size()) throw std::invalid_argument(std::string(flag) + " needs a value");
+            auto value = flags[++i];
+            if (one_of(paths, flag)) continue;
+
+            std::string key(flag.substr(2));
+            std::ranges::replace(key, '-', '_');
+            if (!s.set(key, value) && !generated.set(key, value))
+                throw std::invalid_argument("unknown option " + std::string(flag));
+        }
+        return s;
+    };
 
-    auto samples_ptr = std::make_unique<std::array<Color, image_width * image_height>>();
-    auto image_ptr = std::make_unique<std::array<Color3<uint8_t>, image_width * image_height>>();
-    auto& samples = *samples_ptr;
-    auto& image = *image_ptr;
+    render::Settings settings;
+    std::optional<camera::SimpleCamera<World>> loaded_cam;
+    try {
+        if (scene_path) {
+            auto loaded = scenefile::load(*scene_path, world);
+            loaded_cam = loaded.camera;
+            settings = configure(loaded.settings);
+        } else {
+            settings = configure({});
+        }
+    } catch (std::exception const& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    /*
+    auto cam = scenes::random_scene(world, settings.aspect_ratio());
+    */
+    auto cam = loaded_cam ? *loaded_cam
+        : has_flag("--generate") ? generate::scene(world, generated, settings.aspect_ratio())
+        : scenes::five_spheres(world, settings.aspect_ratio());
+    if (!scene_path) world.build();
+    std::cerr << world.objects.size() << " objects ready in "
+        << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_start).count() << " ms\n";
+    if (has_flag("--generate") || has_flag("--memory"))
+        bench::footprint(world);
+
+    if (auto out = flag_value("--write-scene")) {
+        try {
+            scenefile::write(*out, world, cam, settings);
+        } catch (std::exception const& e) {
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
+    }
 
-    // World
+    auto const [image_width, image_height, samples_per_pixel, samples_per_iter, max_depth] = settings;
+    render::Frame const frame { image_width, image_height, max_depth, 0 };
 
-    using Lambertian = material::Lambertian<World>;
-    using Metal = material::Metal<World>;
-    using Dielectric = material::Dielectric<World>;
+    memory::Buffer<Color> samples(size_t(image_width) * image_height);
+    memory::Buffer<Color3<uint8_t>> image(samples.size());
 
-    object::HittableList<World> world;
-    /*
-    random_scene<World>(world);
-    */
+    // first hit guides and the filtered image, only allocated when denoising
+    memory::Buffer<Color> albedo(denoise ? samples.size() : 0), filtered(albedo.size());
+    memory::Buffer<typename World::Vec> normal(albedo.size());
+    render::PassOptions<World> options { .guides = { albedo, normal } };
 
-    auto material_ground = Lambertian{{0.8, 0.8, 0.0}};
-    auto material_center = Lambertian{{0.1, 0.2, 0.5}};
-    auto material_left   = Dielectric{1.5};
-    auto material_right  = Metal{{0.8, 0.6, 0.2}, 0.0};
-
-    world.add<object::Sphere>({{ 0,-100.5,-1}, 100, material_ground});
-    world.add<object::Sphere>({{ 0, 0,-1},  0.5, material_center});
-    world.add<object::Sphere>({{-1, 0,-1},  0.5, material_left});
-    world.add<object::Sphere>({{-1, 0,-1}, -0.4, material_left});
-    world.add<object::Sphere>({{ 1, 0,-1},  0.5, material_right});
-
-    // Camera
-    Loc look_from {3,3,2};
-    Loc look_to {0,0,-1};
-    Num dist_to_focus = (look_from-Loc{-1,0,-1}).length();
-    Num aperture = 0.5;
-
-    camera::SimpleCamera<World> cam(
-        look_from, look_to, Vec::Up,
-        20, aspect_ratio,
-        aperture, dist_to_focus);
-    /*
-    Loc look_from {13,2,3};
-    Loc look_to {0,0,0};
-    Num dist_to_focus = 10;
-    Num aperture = 0.1;
-
-    camera::SimpleCamera<World> cam(
-        look_from, look_to, Vec::Up,
-        20, aspect_ratio,
-        aperture, dist_to_focus);
-    */
+    auto lights = light::LightBVH<World>::build(world);
+    render::Scene scene { world, lights };
+
+    std::optional<cache::RadianceCache<Num, Color>> radiance_cache;
+    if (use_cache) options.cache = &radiance_cache.emplace();
+
+    std::optional<guiding::SDTree<Num>> guide;
+    if (use_guiding) options.guiding = &guide.emplace(world.bounds());
 
     // Output
 
     auto quantize_samples = [&](auto s)
     {
-        for (auto j = 0; j < image_height; ++j)
-            for (auto i = 0; i < image_width; ++i)
-            {
-                auto pixel_color = samples[(image_height-j-1)*image_width + i];
-                
-                pixel_color *= (Num(1) / s);
-                pixel_color = map(pixel_color, [](auto v){ return std::sqrt(v); });
-                pixel_color = clamp(pixel_color, 0.0, 0.9999) * 256;
-
-                image[j*image_width + i] = color_cast<Color3<uint8_t>>(pixel_color);
-            }
+        if (denoise)
+            render::quantize(std::span<Color const> { filtered }, std::span { image }, frame, 1);
+        else
+            render::quantize(std::span<Color const> { samples }, std::span { image }, frame, s);
     };
     auto output_image = [&]()
     {
@@ -233,23 +245,13 @@ auto main() -> int
     };
 
     // Render
-    static common::RandomState rss;
-
-    struct ThreadLocal {
-        common::RandomState rs;
-
-        ThreadLocal() : rs(rss.sub()) { }
-    };
     scheduler::Scheduler<12, ThreadLocal> scheduler;
 
-    auto sample = [&](auto i, auto j, auto& rs)
-    {
-            const auto u = Num(i + rand<double>(rs)) / (image_width-1);
-            const auto v = Num(j + rand<double>(rs)) / (image_height-1);
-
-            auto r = cam.get_ray(u, v, rs);
-            return ray_color(r, world, rs, max_depth);
-    };
+    std::optional<photon::CausticMap<Num, Color>> caustics;
+    if (use_caustics) {
+        photon::trace<World>(scheduler, scene, caustics.emplace());
+        options.caustics = &*caustics;
+    }
 
     auto current_sample = 0;
     std::function<void(double)> print_status = [&](double pct)
@@ -266,16 +268,20 @@ auto main() -> int
     {
         auto samples_this_frame = std::min(samples_per_iter, samples_per_pixel-current_sample);
 
-        for (auto j = 0; j < image_height; ++j)
-        {
-            scheduler.schedule([&,j](ThreadLocal& tl) {
-                for (auto i = 0; i < image_width; ++i)
-                    for (auto k = 0; k < samples_this_frame; ++k)
-                        samples[j*image_width + i] += sample(i, j, tl.rs);
-            });
-        }
+        render::schedule_pass<World>(scheduler, scene, cam, std::span { samples }, frame,
+            current_sample, samples_this_frame, options);
 
-        scheduler.wait();
+        if (denoise || options.cache || options.guiding) {
+            scheduler.flush();
+            if (options.cache) options.cache->merge();
+            if (options.guiding) options.guiding->merge();
+        } else {
+            scheduler.wait();
+        }
+        if (denoise) {
+            denoise::atrous<World>(scheduler, frame, std::span<Color const> { samples }, options.guides,
+                current_sample+samples_this_frame, std::span { filtered });
+        }
 
         scheduler.schedule([&,current_sample](ThreadLocal& tl) {
             quantize_samples(current_sample+samples_this_frame);
@@ -8,25 +8,60 @@ namespace material
 {
     using namespace dispatch;
 
+    // How a scattered direction was picked.
+    enum class Lobe
+    {
+        Specular,   // a single direction, no density to weight against
+        Diffuse,
+        Glossy,
+    };
+
+    /*
+    One sampled bounce:
+        - `attenuation` is the bsdf times the cosine, already divided by `pdf`
+        - `pdf` is the solid angle density of `scattered`, zero for specular lobes
+    */
     template<WorldLike TWorld>
     struct ScatterResult
     {
+        using Num = typename TWorld::Num;
         using Ray = typename TWorld::Ray;
         using Color = typename TWorld::Color;
 
         Ray scattered;
         Color attenuation;
+        Num pdf;
+        Lobe lobe;
     };
 
-    template<typename TWorld>
-    using SamplerFunc = typename TWorld::Vec (*)(typename TWorld::Vec);
-
     template<typename T, typename TWorld=T::World>
     concept Material = WorldLike<TWorld> and std::same_as<TWorld, typename T::World>
-        and requires (T const m, typename TWorld::Ray const ray_in, object::HitRecord<TWorld> const rec, common::RandomState rs) {
+        and requires (T const m, typename TWorld::Ray const ray_in, object::HitRecord<TWorld> const rec, sampler::Independent rs) {
             { m.scatter(ray_in, rec, rs) } -> std::convertible_to<std::optional<ScatterResult<TWorld>>>;
         };
 
+    // Materials that give off light, `emitted` is the radiance leaving the surface towards the viewer.
+    template<typename T, typename TWorld=T::World>
+    concept Emitter = Material<T, TWorld>
+        and requires (T const m, object::HitRecord<TWorld> const rec) {
+            { m.emitted(rec) } -> std::convertible_to<typename TWorld::Color>;
+        };
+
+    // Materials whose scattering can be evaluated for any direction, rather than only sampled.
+    // Only these take part in light sampling: `eval` is the bsdf times the cosine, and `pdf`
+    // the solid angle density `scatter` picks `wi` with.
+    template<typename T, typename TWorld=T::World>
+    concept Evaluable = Material<T, TWorld>
+        and requires (T const m, typename TWorld::Ray const ray_in, object::HitRecord<TWorld> const rec, typename TWorld::Vec wi) {
+            { m.eval(ray_in, rec, wi) } -> std::convertible_to<typename TWorld::Color>;
+            { m.pdf(ray_in, rec, wi) } -> std::convertible_to<typename TWorld::Num>;
+        };
+
+    // Materials that reflect the same radiance towards every direction, so what leaves
+    // them only depends on where they are lit (see cache::RadianceCache).
+    template<typename T, typename TWorld=T::World>
+    concept Diffuse = Evaluable<T, TWorld> and T::diffuse;
+
     template<Material... TVariants>
     struct MaterialDispatch
         : public dispatch::DispatchGroup<TVariants...>
@@ -42,31 +77,75 @@ namespace material
         using Ray = typename World::Ray;
         using Scatter = ScatterResult<World>;
 
-        constexpr auto scatter(Ray const& in, auto const& hit_rec, common::RandomState& rs) const -> std::optional<Scatter> {
+        constexpr bool operator==(Absorb const&) const = default;
+
+        constexpr auto scatter(Ray const& in, auto const& hit_rec, sampler::Sampler auto& rs) const -> std::optional<Scatter> {
+            return std::nullopt;
+        }
+    };
+
+    template<WorldLike TWorld>
+    struct Emissive
+    {
+        using World = TWorld;
+        using Ray = typename World::Ray;
+        using Color = typename World::Color;
+        using Scatter = ScatterResult<World>;
+
+        Color emit;
+
+        constexpr bool operator==(Emissive const&) const = default;
+
+        constexpr auto scatter(Ray const& in, auto const& hit_rec, sampler::Sampler auto& rs) const -> std::optional<Scatter> {
             return std::nullopt;
         }
+
+        constexpr auto emitted(auto const& hit_rec) const -> Color {
+            return hit_rec.front_face ? emit : Color::Black;
+        }
     };
 
     template<WorldLike TWorld>
     struct Lambertian
     {
         using World = TWorld;
+        using Num = typename World::Num;
         using Vec = typename World::Vec;
         using Ray = typename World::Ray;
         using Color = typename World::Color;
+        using ColorNum = typename Color::Num;
         using Scatter = ScatterResult<World>;
 
+        using Directions = typename World::Config::LambertianSampler;
+
+        static constexpr bool diffuse = true;
+
         Color albedo;
 
-        constexpr auto scatter(Ray const& in, auto const& hit_rec, common::RandomState& rs) const -> std::optional<Scatter> {
-            auto scatter_dir = World::Config::lambertian_sampler(hit_rec.normal, rs);
-            if (near_zero(scatter_dir)) scatter_dir = hit_rec.normal;
+        constexpr bool operator==(Lambertian const&) const = default;
+
+        constexpr auto scatter(Ray const& in, auto const& hit_rec, sampler::Sampler auto& rs) const -> std::optional<Scatter> {
+            auto [u1, u2] = sampler::get2d<Num>(rs);
+            auto [scatter_dir, pdf] = Directions::sample(hit_rec.normal, u1, u2);
+            if (pdf <= 0) return std::nullopt;
 
             return Scatter {
-                Ray{hit_rec.point, scatter_dir},
-                albedo
+                hit_rec.spawn_ray(scatter_dir),
+                ColorNum(1 / pdf) * eval(in, hit_rec, scatter_dir),
+                pdf,
+                Lobe::Diffuse
             };
         }
+
+        constexpr auto eval(Ray const& in, auto const& hit_rec, Vec const& wi) const -> Color {
+            auto cos_theta = dot(hit_rec.normal, wi);
+            if (cos_theta <= 0) return Color::Black;
+            return ColorNum(cos_theta / common::pi) * albedo;
+        }
+
+        constexpr auto pdf(Ray const& in, auto const& hit_rec, Vec const& wi) const -> Num {
+            return Directions::pdf(hit_rec.normal, wi);
+        }
     };
 
     template<WorldLike TWorld>
@@ -77,20 +156,80 @@ namespace material
         using Vec = typename World::Vec;
         using Ray = typename World::Ray;
         using Color = typename World::Color;
+        using ColorNum = typename Color::Num;
         using Scatter = ScatterResult<World>;
 
         Color albedo;
-        Num fuzz;
-
-        constexpr auto scatter(Ray const& in, auto const& hit_rec, common::RandomState& rs) const -> std::optional<Scatter> {
-            auto reflected = reflect(unit_vector(in.direction), hit_rec.normal) + fuzz*vmath::rand_in_sphere<Vec>(rs);
-            if (dot(reflected, hit_rec.normal) > 0)
-                return Scatter {
-                    Ray{hit_rec.point, reflected},
-                    albedo
-                };
-            else
-                return std::nullopt;
+        Num fuzz; // GGX roughness, zero is a perfect mirror
+
+        constexpr bool operator==(Metal const&) const = default;
+
+        constexpr auto scatter(Ray const& in, auto const& hit_rec, sampler::Sampler auto& rs) const -> std::optional<Scatter> {
+            if (is_mirror()) {
+                auto reflected = reflect(unit_vector(in.direction), hit_rec.normal);
+                if (dot(reflected, hit_rec.normal) <= 0) return std::nullopt;
+                return Scatter { hit_rec.spawn_ray(reflected), albedo, 0, Lobe::Specular };
+            }
+
+            // Sample a microfacet normal proportional to D(h) cos(h), then reflect about it.
+            auto a2 = fuzz * fuzz;
+            auto [u, v] = sampler::get2d<Num>(rs);
+            auto phi = Num(2 * common::pi) * v;
+            auto cos_h = std::sqrt((1 - u) / (1 + (a2 - 1) * u));
+            auto sin_h = std::sqrt(std::max(Num(0), 1 - cos_h * cos_h));
+            auto h = vmath::from_local(Vec { sin_h * std::cos(phi), sin_h * std::sin(phi), cos_h }, hit_rec.normal);
+
+            auto wi = reflect(unit_vector(in.direction), h);
+            auto pdf = this->pdf(in, hit_rec, wi);
+            if (pdf <= 0) return std::nullopt;
+
+            return Scatter {
+                hit_rec.spawn_ray(wi),
+                ColorNum(1 / pdf) * eval(in, hit_rec, wi),
+                pdf,
+                Lobe::Glossy
+            };
+        }
+
+        // Cook-Torrance with the albedo as a constant Fresnel term.
+        constexpr auto eval(Ray const& in, auto const& hit_rec, Vec const& wi) const -> Color {
+            auto wo = -unit_vector(in.direction);
+            auto cos_o = dot(hit_rec.normal, wo);
+            auto cos_i = dot(hit_rec.normal, wi);
+            if (is_mirror() || cos_o <= 0 || cos_i <= 0) return Color::Black;
+
+            auto h = unit_vector(wo + wi);
+            auto dg = ggx_d(dot(hit_rec.normal, h)) * smith_g1(cos_o) * smith_g1(cos_i);
+            return ColorNum(dg / (4 * cos_o)) * albedo;
+        }
+
+        constexpr auto pdf(Ray const& in, auto const& hit_rec, Vec const& wi) const -> Num {
+            auto wo = -unit_vector(in.direction);
+            if (is_mirror() || dot(hit_rec.normal, wi) <= 0) return 0;
+
+            auto h = unit_vector(wo + wi);
+            auto wo_h = dot(wo, h);
+            if (wo_h <= 0) return 0;
+            auto cos_h = dot(hit_rec.normal, h);
+            return ggx_d(cos_h) * cos_h / (4 * wo_h);
+        }
+
+    private:
+        constexpr bool is_mirror() const { return fuzz < Num(1e-3); }
+
+        // Trowbridge-Reitz normal distribution.
+        constexpr auto ggx_d(Num cos_h) const -> Num {
+            if (cos_h <= 0) return 0;
+            auto a2 = fuzz * fuzz;
+            auto d = cos_h * cos_h * (a2 - 1) + 1;
+            return a2 / (Num(common::pi) * d * d);
+        }
+
+        // Smith masking for one direction.
+        constexpr auto smith_g1(Num cos_theta) const -> Num {
+            auto cos2 = cos_theta * cos_theta;
+            auto tan2 = (1 - cos2) / cos2;
+            return 2 / (1 + std::sqrt(1 + fuzz * fuzz * tan2));
         }
     };
 
@@ -106,33 +245,42 @@ namespace material
 
         Num ir; // Index of Refraction
 
-        constexpr auto scatter(Ray const& in, auto const& hit_rec, common::RandomState& rs) const -> std::optional<Scatter> {
+        constexpr bool operator==(Dielectric const&) const = default;
+
+        constexpr auto scatter(Ray const& in, auto const& hit_rec, sampler::Sampler auto& rs) const -> std::optional<Scatter> {
             constexpr auto attenuation = Color::White;
-            Num refraction_ratio = hit_rec.front_face ? (1.0/ir) : ir;
+            Num refraction_ratio = this->refraction_ratio(hit_rec);
 
             Vec unit_direction = unit_vector(in.direction);
-            Num cos_theta = std::min(dot(-unit_direction, hit_rec.normal), 1.0);
-            Num sin_theta = std::sqrt(1.0 - cos_theta*cos_theta);
+            Num cos_theta = std::min(dot(-unit_direction, hit_rec.normal), Num(1));
+            Num sin_theta = std::sqrt(1 - cos_theta*cos_theta);
 
-            bool cannot_refract = refraction_ratio * sin_theta > 1.0;
+            bool cannot_refract = refraction_ratio * sin_theta > 1;
             Vec direction;
-            if (cannot_refract || reflectance(cos_theta, refraction_ratio) > rand<Num>(rs))
+            if (cannot_refract || reflectance(cos_theta, refraction_ratio) > sampler::get1d<Num>(rs))
                 direction = reflect(unit_direction, hit_rec.normal);
             else
                 direction = refract(unit_direction, hit_rec.normal, refraction_ratio);
 
             return Scatter {
-                Ray{hit_rec.point, direction},
-               attenuation
+                hit_rec.spawn_ray(direction),
+                attenuation,
+                0,
+                Lobe::Specular
             };
         }
 
+        // Index of refraction on the side a ray arrives from over the side it refracts into.
+        constexpr auto refraction_ratio(auto const& hit_rec) const -> Num {
+            return hit_rec.front_face ? (1/ir) : ir;
+        }
+
     private:
         static Num reflectance(Num cosine, Num ref_idx) {
             // Use Schlick's approximation for reflectance.
             auto r0 = (1-ref_idx) / (1+ref_idx);
             r0 = r0*r0;
-            return r0 + (1-r0)*std::pow((1 - cosine),5);
+            return r0 + (1-r0)*std::pow((1 - cosine), Num(5));
         }
     };
 }
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <new>
+#include <bit>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <concepts>
+#include <cstddef>
+#include <limits>
+#include <utility>
+#include <algorithm>
+
+/*
+Memory for large buffers:
+    - `AlignedAllocator` hands out storage on `Alignment` byte boundaries, a cache line
+      by default, so a buffer's rows start where the vector units want them and two
+      threads' ranges never share a line at the start
+    - `Buffer` is a `std::vector` with it, for buffers sized at run time
+    - `Arena` hands out memory front to back from blocks it keeps, and takes it all back
+      at once by moving its front back to a `mark`, so transient buffers of a build or a
+      pass cost a pointer bump and never go back to the general allocator
+    - `scratch` is every thread's own arena, `Rewind` gives back what a scope took from it
+    - `ArenaVector` is a `std::vector` in an arena; freeing is a no-op, so it is sized or
+      reserved up front rather than grown
+    - `Shared` is a counted reference to a value owned by a `std::shared_ptr`, kept in one
+      pointer aligned to four bytes, so an object holding it packs as tightly as a sphere
+*/
+namespace memory
+{
+    template<typename T, std::size_t Alignment = 64>
+    struct AlignedAllocator
+    {
+        static_assert(Alignment >= alignof(T) && (Alignment & (Alignment - 1)) == 0, "alignment is a power of two at least that of T");
+
+        using value_type = T;
+
+        template<typename U>
+        struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+        constexpr AlignedAllocator() noexcept = default;
+        template<typename U>
+        constexpr AlignedAllocator(AlignedAllocator<U, Alignment> const&) noexcept { }
+
+        auto allocate(std::size_t n) -> T*
+        {
+            if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) throw std::bad_array_new_length();
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t { Alignment }));
+        }
+
+        void deallocate(T* p, std::size_t n) noexcept
+        {
+            ::operator delete(p, n * sizeof(T), std::align_val_t { Alignment });
+        }
+
+        template<typename U>
+        constexpr bool operator==(AlignedAllocator<U, Alignment> const&) const noexcept { return true; }
+    };
+
+    template<typename T>
+    using Buffer = std::vector<T, AlignedAllocator<T>>;
+
+    class Arena
+    {
+        public:
+            static constexpr size_t alignment = 64;
+
+            // Where the arena's front is, to go back to.
+            struct Mark
+            {
+                size_t block = 0;
+                size_t used = 0;
+            };
+
+        private:
+            struct Block
+            {
+                std::byte* data;
+                size_t size;
+            };
+
+            size_t _block_size;
+            std::vector<Block> _blocks;
+            Mark _front;
+
+        public:
+            explicit Arena(size_t block_size = size_t(1) << 20) : _block_size { block_size } { }
+
+            Arena(Arena const&) = delete;
+            Arena& operator=(Arena const&) = delete;
+
+            ~Arena()
+            {
+                for (auto const& b : _blocks)
+                    ::operator delete(b.data, b.size, std::align_val_t { alignment });
+            }
+
+            auto allocate(size_t bytes, size_t align = alignment) -> void*
+            {
+                align = std::max(align, alignment);
+                while (_front.block < _blocks.size())
+                {
+                    auto const& b = _blocks[_front.block];
+                    auto at = (_front.used + align - 1) & ~(align - 1);
+                    if (at + bytes <= b.size) {
+                        _front.used = at + bytes;
+                        return b.data + at;
+                    }
+                    // the rest of this block waits for the next rewind
+                    ++_front.block;
+                    _front.used = 0;
+                }
+
+                auto size = std::max(_block_size, bytes);
+                auto data = static_cast<std::byte*>(::operator new(size, std::align_val_t { alignment }));
+                _blocks.push_back({ data, size });
+                _front = { _blocks.size() - 1, bytes };
+                return data;
+            }
+
+            auto mark() const -> Mark { return _front; }
+
+            // Takes back everything allocated since `m`, keeping the blocks.
+            void rewind(Mark m) { _front = m; }
+            void reset() { rewind({}); }
+
+            auto capacity() const -> size_t
+            {
+                size_t n = 0;
+                for (auto const& b : _blocks) n += b.size;
+                return n;
+            }
+    };
+
+    template<typename T>
+    struct ArenaAllocator
+    {
+        using value_type = T;
+
+        Arena* arena;
+
+        constexpr ArenaAllocator(Arena& a) noexcept : arena { &a } { }
+        template<typename U>
+        constexpr ArenaAllocator(ArenaAllocator<U> const& other) noexcept : arena { other.arena } { }
+
+        auto allocate(std::size_t n) -> T*
+        {
+            if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) throw std::bad_array_new_length();
+            return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+        }
+
+        void deallocate(T*, std::size_t) noexcept { }
+
+        template<typename U>
+        constexpr bool operator==(ArenaAllocator<U> const& other) const noexcept { return arena == other.arena; }
+    };
+
+    template<typename T>
+    using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+    // This thread's arena for transient buffers, its blocks kept for the thread's lifetime.
+    inline auto scratch() -> Arena&
+    {
+        thread_local Arena arena;
+        return arena;
+    }
+
+    // Rewinds `arena` to where it was when the scope began. Buffers taken from it in the
+    // scope have to be gone by then, so it is declared before them.
+    class Rewind
+    {
+        Arena& _arena;
+        Arena::Mark _mark;
+
+        public:
+            explicit Rewind(Arena& arena = scratch()) : _arena { arena }, _mark { arena.mark() } { }
+            Rewind(Rewind const&) = delete;
+            Rewind& operator=(Rewind const&) = delete;
+            ~Rewind() { _arena.rewind(_mark); }
+
+            auto arena() const -> Arena& { return _arena; }
+
+            // An empty vector in the arena.
+            template<typename T>
+            auto vector() const { return ArenaVector<T>(ArenaAllocator<T> { _arena }); }
+
+            template<typename T>
+            auto vector(size_t n) const { return ArenaVector<T>(n, ArenaAllocator<T> { _arena }); }
+    };
+
+    // Shares ownership of the value of a `std::shared_ptr` like another `std::shared_ptr`
+    // would, for objects kept by the million: the count sits next to the owning pointer
+    // instead of in the object, and the one pointer left is stored as two 32 bit words,
+    // so neither widens nor realigns the slots of an object variant.
+    template<typename T>
+    class Shared
+    {
+        struct Node
+        {
+            std::atomic<uint32_t> refs;
+            std::shared_ptr<T> value;
+        };
+
+        using Bits = std::array<uint32_t, sizeof(Node*) / sizeof(uint32_t)>;
+        Bits _bits {};
+
+        auto node() const { return std::bit_cast<Node*>(_bits); }
+
+        public:
+            Shared() = default;
+
+            template<typename U> requires std::convertible_to<std::shared_ptr<U>, std::shared_ptr<T>>
+            Shared(std::shared_ptr<U> value)
+                : _bits { value ? std::bit_cast<Bits>(new Node { 1, std::move(value) }) : Bits {} } { }
+
+            Shared(Shared const& other) noexcept : _bits { other._bits }
+            {
+                if (auto n = node()) n->refs.fetch_add(1, std::memory_order_relaxed);
+            }
+            Shared(Shared&& other) noexcept : _bits { std::exchange(other._bits, Bits {}) } { }
+
+            Shared& operator=(Shared other) noexcept
+            {
+                std::swap(_bits, other._bits);
+                return *this;
+            }
+
+            ~Shared()
+            {
+                if (auto n = node(); n && n->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    delete n;
+            }
+
+            auto get() const -> T* { auto n = node(); return n ? n->value.get() : nullptr; }
+            auto operator->() const -> T* { return node()->value.get(); }
+            auto operator*() const -> T& { return *node()->value; }
+            explicit operator bool() const { return node() != nullptr; }
+    };
+}
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <span>
+#include <array>
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <utility>
+#include <optional>
+#include <stdexcept>
+#include <filesystem>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "owrt.hpp"
+
+#include "bvh.hpp"
+#include "bounds.hpp"
+
+/*
+Triangle meshes:
+    - Vertex positions and triangles are flat arrays, shared by every object that
+      uses the mesh, together with a BVH over the triangles
+    - A mesh file is a header followed by both arrays exactly as they sit in memory,
+      so `Mesh::map` uses the mapped pages in place and only the BVH is built on load
+    - Files are little endian, positions are always 32 bit floats
+*/
+namespace mesh
+{
+    using Position = std::array<float, 3>;
+    using Triangle = std::array<uint32_t, 3>;
+
+    struct Header
+    {
+        static constexpr char file_magic[8] = { 'o', 'w', 'r', 't', 'm', 'e', 's', 'h' };
+        static constexpr uint32_t file_version = 1;
+
+        char magic[8];
+        uint32_t version;
+        uint32_t vertex_count;
+        uint32_t triangle_count;
+        uint32_t reserved = 0;
+    };
+    static_assert(sizeof(Header) == 24 && sizeof(Position) == 12 && sizeof(Triangle) == 12,
+        "mesh files are read in place");
+
+    // A read only mapping of a whole file.
+    class MappedFile
+    {
+        void* _data = nullptr;
+        size_t _size = 0;
+
+        public:
+            MappedFile() = default;
+
+            explicit MappedFile(std::filesystem::path const& path)
+            {
+                auto fd = ::open(path.c_str(), O_RDONLY);
+                if (fd < 0) throw std::runtime_error("can not open " + path.string());
+
+                struct stat st;
+                if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+                    ::close(fd);
+                    throw std::runtime_error("can not map empty file " + path.string());
+                }
+                _size = size_t(st.st_size);
+                _data = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+                ::close(fd);
+                if (_data == MAP_FAILED) {
+                    _data = nullptr;
+                    throw std::runtime_error("can not map " + path.string());
+                }
+            }
+
+            MappedFile(MappedFile&& o) noexcept
+                : _data { std::exchange(o._data, nullptr) }, _size { std::exchange(o._size, 0) }
+            { }
+            MappedFile& operator=(MappedFile&& o) noexcept
+            {
+                std::swap(_data, o._data);
+                std::swap(_size, o._size);
+                return *this;
+            }
+            ~MappedFile() { if (_data) ::munmap(_data, _size); }
+
+            auto bytes() const -> std::span<std::byte const> { return { static_cast<std::byte const*>(_data), _size }; }
+    };
+
+    class Mesh
+    {
+        std::span<Position const> _positions;
+        std::span<Triangle const> _triangles;
+        bvh::Bvh<float> _bvh;
+
+        // whichever holds the arrays
+        std::vector<Position> _own_positions;
+        std::vector<Triangle> _own_triangles;
+        std::shared_ptr<MappedFile const> _file;
+
+        struct Private { };
+
+        public:
+            Mesh(Private, std::vector<Position> positions, std::vector<Triangle> triangles)
+                : _own_positions { std::move(positions) }, _own_triangles { std::move(triangles) }
+            {
+                init(_own_positions, _own_triangles);
+            }
+
+            Mesh(Private, std::shared_ptr<MappedFile const> file, std::span<Position const> positions, std::span<Triangle const> triangles,
+                std::optional<bvh::Bvh<float>> prebuilt)
+                : _file { std::move(file) }
+            {
+                init(positions, triangles, std::move(prebuilt));
+            }
+
+            static auto from(std::vector<Position> positions, std::vector<Triangle> triangles) -> std::shared_ptr<Mesh const>
+            {
+                return std::make_shared<Mesh const>(Private {}, std::move(positions), std::move(triangles));
+            }
+
+            // Maps a mesh file, throwing `std::runtime_error` when it is not one.
+            static auto map(std::filesystem::path const& path) -> std::shared_ptr<Mesh const>
+            {
+                MappedFile file { path };
+                auto bytes = file.bytes();
+                auto bad = [&](char const* why) { return std::runtime_error(path.string() + ": " + why); };
+
+                Header header;
+                if (bytes.size() < sizeof(Header)) throw bad("too short for a mesh header");
+                std::memcpy(&header, bytes.data(), sizeof(Header));
+                if (std::memcmp(header.magic, Header::file_magic, sizeof(header.magic)) != 0) throw bad("not a mesh file");
+                if (header.version != Header::file_version) throw bad("unsupported mesh version");
+
+                auto positions_size = size_t(header.vertex_count) * sizeof(Position);
+                auto triangles_size = size_t(header.triangle_count) * sizeof(Triangle);
+                if (bytes.size() != sizeof(Header) + positions_size + triangles_size) throw bad("size does not match its header");
+
+                auto data = bytes.data() + sizeof(Header);
+                std::span positions { reinterpret_cast<Position const*>(data), header.vertex_count };
+                std::span triangles { reinterpret_cast<Triangle const*>(data + positions_size), header.triangle_count };
+                return std::make_shared<Mesh const>(Private {}, std::make_shared<MappedFile const>(std::move(file)), positions, triangles, std::nullopt);
+            }
+
+            // A mesh over arrays inside `file`, which it keeps mapped, with its BVH when one was
+            // kept along with them.
+            static auto view(std::shared_ptr<MappedFile const> file, std::span<Position const> positions, std::span<Triangle const> triangles,
+                std::optional<bvh::Bvh<float>> prebuilt = std::nullopt) -> std::shared_ptr<Mesh const>
+            {
+                return std::make_shared<Mesh const>(Private {}, std::move(file), positions, triangles, std::move(prebuilt));
+            }
+
+            auto positions() const { return _positions; }
+            auto triangles() const { return _triangles; }
+            auto bvh() const -> bvh::Bvh<float> const& { return _bvh; }
+            auto bounds() const { return _bvh.bounds(); }
+
+            auto vertices(uint32_t triangle) const -> std::array<Position, 3>
+            {
+                auto [a, b, c] = _triangles[triangle];
+                return { _positions[a], _positions[b], _positions[c] };
+            }
+
+        private:
+            void init(std::span<Position const> positions, std::span<Triangle const> triangles, std::optional<bvh::Bvh<float>> prebuilt = std::nullopt)
+            {
+                _positions = positions;
+                _triangles = triangles;
+
+                if (prebuilt) {
+                    for (auto const& tri : triangles)
+                        for (auto v : tri)
+                            if (v >= positions.size()) throw std::runtime_error("mesh triangle refers past its vertices");
+                    if (prebuilt->order().size() != triangles.size()) throw std::runtime_error("mesh bvh is over other triangles");
+                    _bvh = std::move(*prebuilt);
+                    return;
+                }
+
+                std::vector<vmath::Bounds3<float>> bounds(triangles.size());
+                for (size_t i = 0; i < triangles.size(); ++i)
+                    for (auto v : triangles[i]) {
+                        if (v >= positions.size()) throw std::runtime_error("mesh triangle refers past its vertices");
+                        bounds[i].merge(vmath::Loc3<float> { positions[v][0], positions[v][1], positions[v][2] });
+                    }
+                _bvh = bvh::Bvh<float> { bounds };
+            }
+    };
+
+    // Writes a mesh file `Mesh::map` reads.
+    inline void write(std::filesystem::path const& path, std::span<Position const> positions, std::span<Triangle const> triangles)
+    {
+        Header header;
+        std::memcpy(header.magic, Header::file_magic, sizeof(header.magic));
+        header.version = Header::file_version;
+        header.vertex_count = uint32_t(positions.size());
+        header.triangle_count = uint32_t(triangles.size());
+
+        std::ofstream out(path, std::ios::binary);
+        out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+        out.write(reinterpret_cast<char const*>(positions.data()), positions.size_bytes());
+        out.write(reinterpret_cast<char const*>(triangles.data()), triangles.size_bytes());
+        if (!out) throw std::runtime_error("can not write " + path.string());
+    }
+
+    // A sphere from an icosahedron with every triangle split into four `subdivisions` times,
+    // wound counter clockwise seen from outside.
+    inline auto icosphere(int subdivisions, std::array<float, 3> center, float radius)
+    {
+        auto const t = (1 + std::sqrt(5.0f)) / 2;
+        std::vector<Position> positions {
+            { -1, t, 0 }, { 1, t, 0 }, { -1, -t, 0 }, { 1, -t, 0 },
+            { 0, -1, t }, { 0, 1, t }, { 0, -1, -t }, { 0, 1, -t },
+            { t, 0, -1 }, { t, 0, 1 }, { -t, 0, -1 }, { -t, 0, 1 },
+        };
+        std::vector<Triangle> triangles {
+            { 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 },
+            { 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+            { 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 },
+            { 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 },
+        };
+
+        for (auto s = 0; s < subdivisions; ++s)
+        {
+            std::unordered_map<uint64_t, uint32_t> midpoints;
+            auto midpoint = [&](uint32_t a, uint32_t b) {
+                auto key = uint64_t(std::min(a, b)) << 32 | std::max(a, b);
+                auto [it, added] = midpoints.try_emplace(key, uint32_t(positions.size()));
+                if (added) {
+                    auto const& pa = positions[a];
+                    auto const& pb = positions[b];
+                    positions.push_back({ (pa[0] + pb[0]) / 2, (pa[1] + pb[1]) / 2, (pa[2] + pb[2]) / 2 });
+                }
+                return it->second;
+            };
+
+            std::vector<Triangle> split;
+            split.reserve(4 * triangles.size());
+            for (auto [a, b, c] : triangles)
+            {
+                auto ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+                split.insert(split.end(), { { a, ab, ca }, { b, bc, ab }, { c, ca, bc }, { ab, bc, ca } });
+            }
+            triangles = std::move(split);
+        }
+
+        for (auto& p : positions)
+        {
+            auto length = std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+            for (auto i = 0; i < 3; ++i) p[i] = center[i] + radius * p[i] / length;
+        }
+        return std::pair { std::move(positions), std::move(triangles) };
+    }
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "common.hpp"
+#include "sampler.hpp"
 #include "vmath.hpp"
 #include "color.hpp"
 #include "ray.hpp"
@@ -8,3 +9,6 @@
 #include "dispatch.hpp"
 #include "hittable.hpp"
 #include "material.hpp"
+#include "cache.hpp"
+#include "guiding.hpp"
+#include "photon.hpp"
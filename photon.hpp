@@ -0,0 +1,296 @@
+#pragma once
+
+#include <bit>
+#include <span>
+#include <array>
+#include <tuple>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "owrt.hpp"
+
+#include "bounds.hpp"
+#include "memory.hpp"
+
+/*
+Caustic photon map (Jensen 1996):
+    - Photons leave the lights and are followed through specular bounces only, off
+      `Dielectric` and mirror `Metal` surfaces, and stored where they land on a diffuse one
+    - Diffuse vertices of camera paths add the density of the photons around them, and
+      light those paths then reach through specular bounces alone is not counted again
+    - Photons are kept sorted by the cell of a hashed grid twice the gather radius wide,
+      so a gather visits the 8 cells around the point
+    - Tracing runs as tasks over fixed chunks of photons, each photon from its own sampler,
+      and chunks are joined in order, so the map does not depend on threading
+    - A chunk advances all its photons a bounce at a time, shading the hits of one
+      material type together, its paths in the worker's `memory::scratch` arena
+*/
+namespace photon
+{
+    struct Settings
+    {
+        uint32_t photon_count = 1 << 18;    // emitted, most never reach a specular surface
+        float radius = 0.05;                // gather radius
+        int max_depth = 8;
+        uint64_t seed = 0;
+    };
+
+    template<std::floating_point TNum, color::Tup3Like TColor>
+    class CausticMap
+    {
+        public:
+            using Num = TNum;
+            using Color = TColor;
+            using ColorNum = typename Color::Num;
+            using Loc = vmath::Loc3<Num>;
+            using Vec = vmath::Vec3<Num>;
+
+            struct Photon
+            {
+                Loc position;
+                Vec wi;         // towards where the photon came from
+                Color power;
+            };
+
+        private:
+            // photons [begin, end) of one cell
+            struct Entry
+            {
+                uint64_t key = 0;
+                uint32_t begin = 0;
+                uint32_t end = 0;
+            };
+
+            Settings _settings;
+            std::vector<Photon> _photons;
+            std::vector<Entry> _entries;
+            vmath::Bounds3<Num> _reach;     // where a gather can find any photon
+
+        public:
+            explicit CausticMap(Settings const& settings = {})
+                : _settings { settings }
+            { }
+
+            auto settings() const -> Settings const& { return _settings; }
+            auto size() const { return _photons.size(); }
+            auto empty() const { return _photons.empty(); }
+
+            // Replaces the stored photons, each already divided by the number emitted.
+            void build(std::vector<Photon> photons)
+            {
+                _photons = std::move(photons);
+                _reach = {};
+                for (auto const& p : _photons)
+                    _reach.merge(vmath::Bounds3<Num>::around(p.position, Num(_settings.radius)));
+                std::ranges::stable_sort(_photons, {}, [&](Photon const& p) { return key(cell(p.position)); });
+
+                size_t cells = 0;
+                for (size_t i = 0; i < _photons.size(); ++i)
+                    if (i == 0 || key(cell(_photons[i].position)) != key(cell(_photons[i - 1].position))) ++cells;
+
+                _entries.assign(std::bit_ceil(std::max<size_t>(2 * cells, 16)), Entry {});
+                for (uint32_t begin = 0; begin < _photons.size();)
+                {
+                    auto k = key(cell(_photons[begin].position));
+                    auto end = begin + 1;
+                    while (end < _photons.size() && key(cell(_photons[end].position)) == k) ++end;
+
+                    auto slot = k & mask();
+                    while (_entries[slot].key) slot = (slot + 1) & mask();
+                    _entries[slot] = { k, begin, uint32_t(end) };
+                    begin = end;
+                }
+            }
+
+            // Reflected radiance from the photons within the gather radius of a surface point,
+            // `f(wi)` being its bsdf without the cosine. Photons are counted on a disk around the
+            // point, so light does not leak in from other surfaces close by.
+            auto estimate(Loc const& p, Vec const& n, auto&& f) const -> Color
+            {
+                if (!_reach.contains(p)) return Color::Black;
+
+                auto const r = Num(_settings.radius);
+                auto const lo = cell(p - Vec { r, r, r });
+
+                auto sum = Color::Black;
+                for (auto dz = 0; dz < 2; ++dz)
+                    for (auto dy = 0; dy < 2; ++dy)
+                        for (auto dx = 0; dx < 2; ++dx)
+                        {
+                            auto e = find(key({ lo[0] + dx, lo[1] + dy, lo[2] + dz }));
+                            if (!e) continue;
+
+                            for (auto const& photon : std::span { _photons.data() + e->begin, _photons.data() + e->end })
+                            {
+                                auto d = photon.position - p;
+                                if (d.length_squared() > r * r || std::abs(dot(d, n)) > r / 8) continue;
+                                if (dot(photon.wi, n) <= 0) continue;
+                                sum += f(photon.wi) * photon.power;
+                            }
+                        }
+                return ColorNum(1 / (Num(common::pi) * r * r)) * sum;
+            }
+
+        private:
+            using Cell = std::array<int64_t, 3>;
+
+            auto cell(Loc const& p) const -> Cell
+            {
+                auto size = 2 * Num(_settings.radius);
+                return { int64_t(std::floor(p.x / size)), int64_t(std::floor(p.y / size)), int64_t(std::floor(p.z / size)) };
+            }
+
+            // Cells sharing a key share a slot, which only costs the distance tests. Zero marks an empty slot.
+            static auto key(Cell const& c) -> uint64_t
+            {
+                return common::hash_mix(uint64_t(c[0] * 73856093) ^ uint64_t(c[1] * 19349663) ^ uint64_t(c[2] * 83492791)) | 1;
+            }
+
+            auto mask() const { return _entries.size() - 1; }
+
+            auto find(uint64_t key) const -> Entry const*
+            {
+                for (auto slot = key & mask();; slot = (slot + 1) & mask())
+                {
+                    if (_entries[slot].key == key) return &_entries[slot];
+                    if (_entries[slot].key == 0) return nullptr;
+                }
+            }
+    };
+
+    // Traces `settings.photon_count` photons from the scene's lights into `map`, chosen by power.
+    template<dispatch::WorldLike TWorld>
+    void trace(auto& scheduler, auto const& scene, CausticMap<typename TWorld::Num, typename TWorld::Color>& map)
+    {
+        using Num = typename TWorld::Num;
+        using Vec = typename TWorld::Vec;
+        using Ray = typename TWorld::Ray;
+        using Color = typename TWorld::Color;
+        using ColorNum = typename Color::Num;
+        using Sampler = typename TWorld::Config::PixelSampler;
+        using Photon = typename CausticMap<Num, Color>::Photon;
+
+        auto const& [world, lights] = scene;
+        auto const& settings = map.settings();
+        if (lights.empty() || settings.photon_count == 0) {
+            map.build({});
+            return;
+        }
+
+        // lights by emitted power, a sphere of radiance L emits L * pi * area
+        std::vector<Num> cdf;
+        Num total = 0;
+        for (auto const& light : lights.lights)
+            cdf.push_back(total += color::luminance(light.emit) * light.radius * light.radius);
+
+        constexpr uint32_t chunk_size = 4096;
+        auto const chunks = (settings.photon_count + chunk_size - 1) / chunk_size;
+        std::vector<std::vector<Photon>> stored(chunks);
+
+        // a photon between bounces, dropped once it carries nothing
+        struct Path
+        {
+            Ray r;
+            Color power;
+            Sampler rs;
+            object::HitRecord<TWorld> hit;
+        };
+
+        for (uint32_t c = 0; c < chunks; ++c)
+            scheduler.schedule([&, c](auto&) {
+                memory::Rewind scratch;
+                auto paths = scratch.vector<Path>();
+                auto const first = c * chunk_size, end = std::min(settings.photon_count, (c + 1) * chunk_size), count = end - first;
+                paths.reserve(count);
+
+                // Every photon's light and unit square points are drawn first, then mapped a
+                // whole chunk at a time: points on the lights' spheres, and directions cosine
+                // weighted around them.
+                auto samplers = scratch.vector<Sampler>();
+                samplers.reserve(count);
+                auto chosen = scratch.vector<uint32_t>(count);
+                auto square = scratch.vector<Num>(4 * size_t(count));
+                auto mapped = scratch.vector<Num>(6 * size_t(count));
+                auto column = [&](auto& v, int k) { return std::span { v.data() + size_t(k) * count, count }; };
+                for (uint32_t i = 0; i < count; ++i)
+                {
+                    auto& rs = samplers.emplace_back(Sampler::for_sample(settings.seed, 0, 0, first + i));
+                    auto u = sampler::get1d<Num>(rs) * total;
+                    chosen[i] = uint32_t(std::min<size_t>(std::ranges::upper_bound(cdf, u) - cdf.begin(), cdf.size() - 1));
+                    for (int k = 0; k < 4; k += 2)
+                        std::tie(column(square, k)[i], column(square, k + 1)[i]) = sampler::get2d<Num>(rs);
+                }
+                vmath::uniform_sphere_n<Vec>(column(square, 0), column(square, 1), { column(mapped, 0), column(mapped, 1), column(mapped, 2) });
+                vmath::cosine_hemisphere_n<Vec>(column(square, 2), column(square, 3), { column(mapped, 3), column(mapped, 4), column(mapped, 5) });
+
+                for (uint32_t i = 0; i < count; ++i)
+                {
+                    auto l = chosen[i];
+                    auto const& light = lights[l];
+                    auto pmf = (cdf[l] - (l ? cdf[l - 1] : Num(0))) / total;
+                    if (pmf <= 0) continue;
+
+                    Vec n { column(mapped, 0)[i], column(mapped, 1)[i], column(mapped, 2)[i] };
+                    auto dir = vmath::from_local(Vec { column(mapped, 3)[i], column(mapped, 4)[i], column(mapped, 5)[i] }, n);
+
+                    auto local = light.radius * n;
+                    auto error = common::gamma<Num>(5) * vmath::abs(local) + common::gamma<Num>(1) * vmath::abs(affine(light.center));
+                    Ray r { vmath::offset_ray_origin(light.center + local, error, n, dir), dir };
+
+                    auto area = Num(4 * common::pi) * light.radius * light.radius;
+                    auto power = ColorNum(Num(common::pi) * area / (pmf * settings.photon_count)) * light.emit;
+                    paths.push_back({ r, power, samplers[i], {} });
+                }
+
+                // The chunk's photons advance a bounce at a time, and each bounce shades their
+                // hits grouped by material type, one loop over one table per type.
+                for (auto bounce = 0; bounce < settings.max_depth && !paths.empty(); ++bounce)
+                {
+                    std::erase_if(paths, [&](Path& p) {
+                        auto query = world.intersect(p.r.span(0, common::infinity));
+                        if (query) p.hit = world.surface(p.r, *query);
+                        return !query;
+                    });
+
+                    world.materials.group(std::span { paths }, [](Path const& p) { return p.hit.material; }, [&](auto table, auto run) {
+                        using M = std::remove_cvref_t<decltype(table[0])>;
+                        for (auto& p : run)
+                        {
+                            auto const& m = table[p.hit.material.index()];
+                            auto const& hit = p.hit;
+                            if constexpr (material::Diffuse<M>) {
+                                // photons straight from the light are left to light sampling
+                                if (bounce > 0)
+                                    stored[c].push_back({ hit.point, -unit_vector(p.r.direction), p.power });
+                                p.power = Color::Black;
+                            } else {
+                                auto s = m.scatter(p.r, hit, p.rs);
+                                if (!s || s->lobe != material::Lobe::Specular) {
+                                    p.power = Color::Black;
+                                    continue;
+                                }
+                                // Camera paths keep radiance unchanged through a refraction rather than scaling it
+                                // by the squared ratio of indices. Photons follow suit, or light from inside glass
+                                // would come out of the map dimmer than the path tracer sees it.
+                                if constexpr (requires { m.refraction_ratio(hit); })
+                                    if (dot(s->scattered.direction, hit.normal) < 0) {
+                                        auto eta = m.refraction_ratio(hit);
+                                        s->attenuation = ColorNum(eta * eta) * s->attenuation;
+                                    }
+                                p.power = p.power * s->attenuation;
+                                p.r = s->scattered;
+                            }
+                        }
+                    });
+                    std::erase_if(paths, [](Path const& p) { return p.power == Color::Black; });
+                }
+            });
+        scheduler.flush();
+
+        std::vector<Photon> photons;
+        for (auto& chunk : stored)
+            photons.insert(photons.end(), chunk.begin(), chunk.end());
+        map.build(std::move(photons));
+    }
+}
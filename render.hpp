@@ -0,0 +1,446 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <fstream>
+#include <charconv>
+#include <stdexcept>
+#include <string_view>
+
+#include "owrt.hpp"
+
+namespace render
+{
+    using common::mix;
+    using common::map;
+    using common::clamp;
+    using common::rand;
+
+    // Everything the integrator reads while tracing.
+    template<object::Hittable TGeometry, typename TLights>
+    struct Scene
+    {
+        TGeometry const& world;
+        TLights const& lights;
+    };
+
+    template<typename Color, vmath::RayLike Ray>
+    constexpr auto sky(Ray const& r) -> Color
+    {
+        using Num = typename Ray::Num;
+        using ColorNum = typename Color::Num;
+
+        constexpr auto color_top = Color::White;
+        constexpr auto color_bot = Color{ColorNum(0.5), ColorNum(0.7), ColorNum(1.0)};
+
+        auto unit_direction = unit_vector(r.direction);
+        auto t = ColorNum(Num(0.5)*(unit_direction.y + 1));
+        return mix(color_top, color_bot, t);
+    }
+
+    // What the camera ray saw first, the guides the denoiser keeps edges along.
+    template<typename Color, typename Vec>
+    struct FirstHit
+    {
+        Color albedo = Color::White;
+        Vec normal {};
+    };
+
+    // Surface color of a material for the guides, white where it has none (glass, lights).
+    template<typename Color>
+    constexpr auto albedo_of(auto const& m) -> Color
+    {
+        if constexpr (requires { { m.albedo } -> std::convertible_to<Color>; })
+            return m.albedo;
+        else
+            return Color::White;
+    }
+
+    // Shadow rays stop this far short of the light, relative to its distance, so they can not hit the light itself.
+    template<typename TNum>
+    constexpr auto shadow_epsilon = TNum(1e-3);
+
+    // One light sample for the surface at `hit`, weighted against the directional sampling
+    // of the vertex: the material's own, mixed with the guide where there is one.
+    template<typename Color>
+    auto sample_light(auto const& r, auto const& hit, auto const& material, auto const& scene, sampler::Sampler auto& rs,
+        auto const& guide) -> Color
+    {
+        using Num = typename std::remove_cvref_t<decltype(r)>::Num;
+        using ColorNum = typename Color::Num;
+
+        auto const& [world, lights] = scene;
+        if (lights.empty()) return Color::Black;
+
+        auto choice = lights.choose(hit.point, hit.normal, sampler::get1d<Num>(rs));
+        if (!choice) return Color::Black;
+        auto const& light = lights[choice->light];
+
+        auto [u1, u2] = sampler::get2d<Num>(rs);
+        auto ls = light.sample(hit.point, u1, u2);
+        if (!ls) return Color::Black;
+
+        auto f = material.eval(r, hit, ls->wi);
+        if (f == Color::Black) return Color::Black;
+
+        auto shadow = hit.spawn_ray(ls->wi);
+        if (world.occluded(shadow.span(0, ls->t * (1 - shadow_epsilon<Num>))))
+            return Color::Black;
+
+        auto light_pdf = choice->pmf * ls->pdf;
+        auto weight = common::power_heuristic(light_pdf, guide.pdf(material.pdf(r, hit, ls->wi), ls->wi));
+        return ColorNum(weight / light_pdf) * (f * light.emit);
+    }
+
+    // Directional sampling from the mixture of the material and the guide, weighted by the combined density.
+    auto guided_scatter(auto const& r, auto const& hit, auto const& material, auto const& guide, sampler::Sampler auto& rs)
+    {
+        using Material = std::remove_cvref_t<decltype(material)>;
+        using Scatter = typename Material::Scatter;
+        using Num = typename Material::Num;
+        using ColorNum = typename Material::Color::Num;
+
+        std::optional<Scatter> scatter;
+        if (sampler::get1d<Num>(rs) < guide.fraction) {
+            auto [u1, u2] = sampler::get2d<Num>(rs);
+            auto wi = guide.sample(u1, u2);
+            scatter = Scatter { hit.spawn_ray(wi), {}, 0, material::Lobe::Diffuse };
+        } else {
+            scatter = material.scatter(r, hit, rs);
+        }
+        if (!scatter) return scatter;
+
+        auto wi = unit_vector(scatter->scattered.direction);
+        scatter->pdf = guide.pdf(material.pdf(r, hit, wi), wi);
+        if (scatter->pdf <= 0) return std::optional<Scatter> {};
+        auto f = material.eval(r, hit, wi);
+        if (f == Material::Color::Black) return std::optional<Scatter> {};
+        scatter->attenuation = ColorNum(1 / scatter->pdf) * f;
+        return scatter;
+    }
+
+    // Optional extras of a path, each only done when set.
+    template<typename Color, vmath::RayLike Ray>
+    struct PathHooks
+    {
+        using Num = typename Ray::Num;
+
+        FirstHit<Color, typename Ray::Vec>* first = nullptr;
+        cache::PathRecorder<cache::RadianceCache<Num, Color>>* cache = nullptr;
+        guiding::PathRecorder<guiding::SDTree<Num>, Color>* guide = nullptr;
+        photon::CausticMap<Num, Color> const* caustics = nullptr;
+    };
+
+    /*
+    Path tracer with next event estimation:
+        - At surfaces that can evaluate their bsdf a light is sampled explicitly
+        - Emission found by bsdf sampling is still counted, both strategies are
+          weighted against each other with the power heuristic
+        - After specular bounces (and for camera rays) only the bsdf could have
+          found the light, so its emission counts in full
+        - With a caustic map, diffuse vertices take caustics from it instead, and
+          lights reached from them through specular bounces alone are skipped
+    */
+    template<typename Color, vmath::RayLike Ray>
+    auto ray_color(Ray r, auto const& scene, sampler::Sampler auto& rs, int depth, PathHooks<Color, Ray> hooks = {}) -> Color
+    {
+        using namespace common;
+
+        using Num = typename Ray::Num;
+        using ColorNum = typename Color::Num;
+        using Loc = typename Ray::Loc;
+        using Vec = typename Ray::Vec;
+
+        auto const& [world, lights] = scene;
+
+        auto radiance = Color::Black;
+        auto throughput = Color::White;
+
+        // the vertex the current ray left from, for weighting emission it finds
+        bool specular_bounce = true;
+        Num bsdf_pdf = 0;
+        Loc prev_point;
+        Vec prev_normal;
+        bool prev_guided = false;
+        bool in_caustic = false;    // only specular bounces since a vertex that gathered caustics
+
+        for (auto bounce = 0; bounce < depth; ++bounce)
+        {
+            // Scattered rays start off the surface by its error bound, so no epsilon is needed on t_min.
+            auto query = world.intersect(r.span(0, infinity));
+            if (!query) {
+                radiance += throughput * sky<Color>(r);
+                break;
+            }
+            auto hit = world.surface(r, *query);
+            if (bounce == 0 && hooks.first) {
+                hooks.first->albedo = world.materials.visit(hit.material, [](auto const& m) { return albedo_of<Color>(m); });
+                hooks.first->normal = hit.normal;
+            }
+
+            auto emitted = world.materials.visit(hit.material, [&](auto const& m) {
+                if constexpr (material::Emitter<std::remove_cvref_t<decltype(m)>>)
+                    return m.emitted(hit);
+                else
+                    return Color::Black;
+            });
+            if (emitted != Color::Black) {
+                // emitters missing from the light list could only have been found this way
+                auto weight = ColorNum(1);
+                auto light = lights.light_of_prim[query->prim];
+                if (in_caustic && specular_bounce && light != lights.none)
+                    weight = 0;
+                else if (!specular_bounce && light != lights.none) {
+                    auto light_pdf = lights.pmf(prev_point, prev_normal, light) * lights[light].pdf(prev_point);
+                    weight = ColorNum(power_heuristic(bsdf_pdf, light_pdf));
+                    // light sampling covers this light, the guide only has to learn the rest
+                    if (prev_guided)
+                        hooks.guide->exclude_last(weight * (throughput * emitted));
+                }
+                radiance += weight * (throughput * emitted);
+            }
+
+            auto diffuse = world.materials.visit(hit.material, [](auto const& m) { return material::Diffuse<std::remove_cvref_t<decltype(m)>>; });
+            if (hooks.cache && diffuse) {
+                auto const& cache = hooks.cache->cache();
+                auto key = cache.key(hit.point, hit.normal);
+                if (bounce >= cache.settings().min_bounce) {
+                    if (auto cached = cache.lookup(key)) {
+                        radiance += throughput * *cached;
+                        break;
+                    }
+                }
+                hooks.cache->add(key, radiance, throughput);
+            }
+
+            bool const gather = hooks.caustics && diffuse;
+            if (gather) {
+                radiance += throughput * world.materials.visit(hit.material, [&](auto const& m) {
+                    if constexpr (material::Diffuse<std::remove_cvref_t<decltype(m)>>)
+                        return hooks.caustics->estimate(hit.point, hit.normal,
+                            [&](Vec const& wi) { return ColorNum(1 / dot(hit.normal, wi)) * m.eval(r, hit, wi); });
+                    else
+                        return Color::Black;
+                });
+            }
+
+            // guiding only learns and samples at diffuse vertices, glossy lobes are narrow enough already
+            uint32_t guide_leaf = 0;
+            guiding::Mixture<Vec> guide;
+            if (hooks.guide && diffuse) {
+                auto const& tree = hooks.guide->tree();
+                guide_leaf = tree.leaf_at(hit.point);
+                if (auto const& dtree = tree.leaf(guide_leaf).sampling; dtree.total() > 0)
+                    guide = { &dtree, Num(tree.settings().guide_fraction) };
+            }
+
+            auto scatter = world.materials.visit(hit.material, [&](auto const& m) {
+                using M = std::remove_cvref_t<decltype(m)>;
+                if constexpr (material::Evaluable<M>) {
+                    radiance += throughput * sample_light<Color>(r, hit, m, scene, rs, guide);
+                    if (guide)
+                        return guided_scatter(r, hit, m, guide, rs);
+                }
+                return m.scatter(r, hit, rs);
+            });
+            if (!scatter) break;
+
+            prev_guided = hooks.guide && diffuse
+                && hooks.guide->add(guide_leaf, unit_vector(scatter->scattered.direction), scatter->pdf, radiance, throughput * scatter->attenuation);
+
+            specular_bounce = scatter->lobe == material::Lobe::Specular;
+            in_caustic = gather || (in_caustic && specular_bounce);
+            bsdf_pdf = scatter->pdf;
+            prev_point = hit.point;
+            prev_normal = hit.normal;
+
+            throughput = throughput * scatter->attenuation;
+            r = scatter->scattered;
+        }
+
+        if (hooks.cache)
+            hooks.cache->finish(radiance);
+        if (hooks.guide)
+            hooks.guide->finish(radiance);
+        return radiance;
+    }
+
+    // Per pixel sums of the first hits, filled alongside the samples when not empty.
+    template<dispatch::WorldLike TWorld>
+    struct Guides
+    {
+        std::span<typename TWorld::Color> albedo;
+        std::span<typename TWorld::Vec> normal;
+
+        constexpr auto empty() const { return albedo.empty(); }
+    };
+
+    struct Frame
+    {
+        int width;
+        int height;
+        int max_depth;
+        uint64_t seed = 0;
+    };
+
+    // What a whole render is asked for, which scene files carry along with the scene.
+    struct Settings
+    {
+        int width = 800;
+        int height = 450;
+        int samples_per_pixel = 100;
+        int samples_per_iter = 10;
+        int max_depth = 50;
+
+        auto aspect_ratio() const { return double(width) / height; }
+
+        // Sets the field named `key` (`width`, `height`, `samples`, `samples_per_iter`,
+        // `max_depth`) from `value`, false if there is no such field. An image is at least
+        // two pixels each way, since pixels are placed at `x / (width - 1)`.
+        auto set(std::string_view key, std::string_view value) -> bool
+        {
+            bool const side = key == "width" || key == "height";
+            int* field = key == "width" ? &width
+                : key == "height" ? &height
+                : key == "samples" ? &samples_per_pixel
+                : key == "samples_per_iter" ? &samples_per_iter
+                : key == "max_depth" ? &max_depth
+                : nullptr;
+            if (!field) return false;
+
+            int v = 0;
+            auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), v);
+            if (ec != std::errc {} || end != value.data() + value.size() || v < (side ? 2 : 1))
+                throw std::invalid_argument("render setting " + std::string(key) + " needs an integer of at least "
+                    + (side ? "2" : "1") + ", not '" + std::string(value) + "'");
+            *field = v;
+            return true;
+        }
+
+        // Reads `key = value` lines, `#` starting a comment.
+        void read(std::string const& path)
+        {
+            std::ifstream in(path);
+            if (!in) throw std::runtime_error("can not open render settings " + path);
+
+            auto trim = [](std::string_view s) {
+                auto b = s.find_first_not_of(" \t\r");
+                if (b == s.npos) return std::string_view {};
+                return s.substr(b, s.find_last_not_of(" \t\r") - b + 1);
+            };
+
+            std::string line;
+            for (int number = 1; std::getline(in, line); ++number)
+            {
+                auto text = trim(std::string_view(line).substr(0, line.find('#')));
+                if (text.empty()) continue;
+                auto eq = text.find('=');
+                if (eq == text.npos || !set(trim(text.substr(0, eq)), trim(text.substr(eq + 1))))
+                    throw std::invalid_argument(path + ":" + std::to_string(number) + ": expected a render setting, not '" + std::string(text) + "'");
+            }
+        }
+    };
+
+    // Optional work done alongside a pass, each only when set. The cache and the guide
+    // learn from the pass, `merge` them once it has run.
+    template<dispatch::WorldLike TWorld>
+    struct PassOptions
+    {
+        using Num = typename TWorld::Num;
+        using Color = typename TWorld::Color;
+
+        Guides<TWorld> guides = {};
+        cache::RadianceCache<Num, Color>* cache = nullptr;
+        guiding::SDTree<Num>* guiding = nullptr;
+        photon::CausticMap<Num, Color> const* caustics = nullptr;    // traced beforehand, only read
+    };
+
+    // Schedules `count` samples per pixel, starting at sample `first`, one task per row.
+    // Every pixel sample draws from its own sampler keyed on (seed, pixel, index), so the
+    // accumulated samples do not depend on the thread count or task order.
+    template<dispatch::WorldLike TWorld>
+    void schedule_pass(
+        auto& scheduler,
+        auto const& scene,
+        auto const& cam,
+        std::span<typename TWorld::Color> samples,
+        Frame const& frame,
+        int first, int count,
+        PassOptions<TWorld> options = {}
+    ) {
+        using Num = typename TWorld::Num;
+        using Color = typename TWorld::Color;
+        using Ray = typename TWorld::Ray;
+        using PixelSampler = typename TWorld::Config::PixelSampler;
+        using Hooks = PathHooks<Color, Ray>;
+
+        if (options.cache)
+            options.cache->begin_pass(frame.height);
+        if (options.guiding)
+            options.guiding->begin_pass(frame.height);
+
+        for (auto j = 0; j < frame.height; ++j)
+        {
+            scheduler.schedule([&scene, &cam, samples, options, frame, first, count, j](auto&) {
+                // recorders collect into this row's records only
+                using CacheRecorder = std::remove_pointer_t<decltype(Hooks::cache)>;
+                using GuideRecorder = std::remove_pointer_t<decltype(Hooks::guide)>;
+                std::optional<CacheRecorder> cache_recorder;
+                std::optional<GuideRecorder> guide_recorder;
+                if (options.cache) cache_recorder.emplace(*options.cache, options.cache->row(j));
+                if (options.guiding) guide_recorder.emplace(*options.guiding, options.guiding->row(j));
+
+                Hooks hooks;
+                hooks.cache = cache_recorder ? &*cache_recorder : nullptr;
+                hooks.guide = guide_recorder ? &*guide_recorder : nullptr;
+                hooks.caustics = options.caustics;
+
+                auto const& guides = options.guides;
+                for (auto i = 0; i < frame.width; ++i)
+                    for (auto k = 0; k < count; ++k)
+                    {
+                        auto rs = PixelSampler::for_sample(frame.seed, i, j, first + k);
+
+                        auto [du, dv] = sampler::get2d<Num>(rs);
+                        auto const u = Num(i + du) / (frame.width-1);
+                        auto const v = Num(j + dv) / (frame.height-1);
+
+                        auto r = cam.get_ray(u, v, rs);
+                        auto const p = j*frame.width + i;
+                        if (guides.empty()) {
+                            samples[p] += ray_color<Color>(r, scene, rs, frame.max_depth, hooks);
+                            continue;
+                        }
+
+                        FirstHit<Color, typename TWorld::Vec> hit;
+                        hooks.first = &hit;
+                        samples[p] += ray_color<Color>(r, scene, rs, frame.max_depth, hooks);
+                        guides.albedo[p] += hit.albedo;
+                        guides.normal[p] += hit.normal;
+                    }
+
+                if (cache_recorder) cache_recorder->compact();
+                if (guide_recorder) guide_recorder->compact();
+            });
+        }
+    }
+
+    // Resolves accumulated samples into a gamma corrected, top-down 8-bit image.
+    template<color::Tup3Like TColor>
+    void quantize(std::span<TColor const> samples, std::span<color::Color3<uint8_t>> image, Frame const& frame, int sample_count)
+    {
+        using Num = typename TColor::Num;
+
+        for (auto j = 0; j < frame.height; ++j)
+            for (auto i = 0; i < frame.width; ++i)
+            {
+                auto pixel_color = samples[(frame.height-j-1)*frame.width + i];
+
+                pixel_color *= (Num(1) / sample_count);
+                pixel_color = map(pixel_color, [](auto v){ return std::sqrt(v); });
+                pixel_color = clamp(pixel_color, Num(0), Num(0.9999)) * Num(256);
+
+                image[j*frame.width + i] = color_cast<color::Color3<uint8_t>>(pixel_color);
+            }
+    }
+}
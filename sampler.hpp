@@ -0,0 +1,147 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <concepts>
+#include <utility>
+
+#include "common.hpp"
+
+/*
+Sample generators for the integrator:
+    - A sampler hands out uniform values one dimension at a time, in the order the path consumes them
+      (pixel jitter, lens, then per bounce: light choice, light position, bsdf direction, ...)
+    - `next2` draws a pair that is stratified jointly, use it for every 2D decision
+    - Each pixel sample gets its own sampler from (seed, x, y, index), so results do not depend on
+      the order the work runs in
+*/
+namespace sampler
+{
+    template<typename T>
+    concept Sampler = requires(T& s) {
+        { s.next() } -> std::same_as<uint32_t>;
+        { s.next2() } -> std::same_as<std::pair<uint32_t, uint32_t>>;
+    } and requires(uint64_t seed, uint32_t x, uint32_t y, uint32_t index) {
+        { T::for_sample(seed, x, y, index) } -> std::same_as<T>;
+    };
+
+    // Maps 32 random bits into [0, 1), never rounding up to 1 for any float type.
+    template<std::floating_point TNum>
+    constexpr auto to_unit(uint32_t bits) -> TNum
+    {
+        if constexpr (sizeof(TNum) < sizeof(double))
+            return TNum(bits >> 8) * TNum(0x1p-24);
+        else
+            return TNum(bits) * TNum(0x1p-32);
+    }
+
+    template<std::floating_point TNum>
+    constexpr auto get1d(Sampler auto& s) -> TNum
+    {
+        return to_unit<TNum>(s.next());
+    }
+
+    template<std::floating_point TNum>
+    constexpr auto get2d(Sampler auto& s) -> std::pair<TNum, TNum>
+    {
+        auto [x, y] = s.next2();
+        return { to_unit<TNum>(x), to_unit<TNum>(y) };
+    }
+
+    // Uncorrelated values from a counter based hash, for reference renders.
+    struct Independent
+    {
+        uint64_t state;
+
+        static constexpr auto for_sample(uint64_t seed, uint32_t x, uint32_t y, uint32_t index)
+        {
+            return Independent { common::hash_combine(seed, x, y, index) };
+        }
+
+        constexpr auto next() -> uint32_t { return uint32_t(common::hash_mix(state++) >> 32); }
+        constexpr auto next2() -> std::pair<uint32_t, uint32_t> { return { next(), next() }; }
+    };
+
+    /*
+    Owen scrambled Sobol points (Burley 2020, "Practical Hash-based Owen Scrambling"):
+        - Every dimension pair uses the first two Sobol dimensions, which are well
+          stratified in 2D, decorrelated from the other pairs by shuffling the index
+        - Scrambling is seeded per pixel, so neighbouring pixels do not share a pattern
+        - Progressive: any prefix of samples is well distributed, powers of two best
+    */
+    struct Sobol
+    {
+        uint32_t seed;
+        uint32_t index;
+        uint32_t dimension = 0;
+
+        static constexpr auto for_sample(uint64_t seed, uint32_t x, uint32_t y, uint32_t index)
+        {
+            return Sobol { uint32_t(common::hash_combine(seed, x, y)), index };
+        }
+
+        constexpr auto next() -> uint32_t
+        {
+            auto s = dimension_seed();
+            return nested_uniform_scramble(sobol0(nested_uniform_scramble(index, s)), hash(s, 1));
+        }
+
+        constexpr auto next2() -> std::pair<uint32_t, uint32_t>
+        {
+            auto s = dimension_seed();
+            auto i = nested_uniform_scramble(index, s);
+            return {
+                nested_uniform_scramble(sobol0(i), hash(s, 1)),
+                nested_uniform_scramble(sobol1(i), hash(s, 2)),
+            };
+        }
+
+    private:
+        static constexpr auto hash(uint32_t a, uint32_t b) -> uint32_t
+        {
+            return uint32_t(common::hash_combine(a, b));
+        }
+
+        constexpr auto dimension_seed() -> uint32_t { return hash(seed, dimension++); }
+
+        // van der Corput, the first Sobol dimension
+        static constexpr auto sobol0(uint32_t i) -> uint32_t { return reverse_bits(i); }
+
+        static constexpr auto sobol1(uint32_t i) -> uint32_t
+        {
+            uint32_t x = 0;
+            for (uint32_t v = 1u << 31; i; i >>= 1, v ^= v >> 1)
+                if (i & 1) x ^= v;
+            return x;
+        }
+
+        static constexpr auto reverse_bits(uint32_t x) -> uint32_t
+        {
+            x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+            x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+            x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+            x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+            return std::rotl(x, 16);
+        }
+
+        // Laine-Karras style hash, only ever flips a bit based on the bits below it.
+        static constexpr auto laine_karras_permutation(uint32_t x, uint32_t s) -> uint32_t
+        {
+            x += s;
+            x ^= x * 0x6c50b47cu;
+            x ^= x * 0xb82f1e52u;
+            x ^= x * 0xc7afe638u;
+            x ^= x * 0x8d22f6e6u;
+            return x;
+        }
+
+        // Owen scrambling of the bits of `x`, most significant bit first.
+        static constexpr auto nested_uniform_scramble(uint32_t x, uint32_t s) -> uint32_t
+        {
+            return reverse_bits(laine_karras_permutation(reverse_bits(x), s));
+        }
+    };
+
+    static_assert(Sampler<Independent>);
+    static_assert(Sampler<Sobol>);
+}
@@ -0,0 +1,337 @@
+#pragma once
+
+#include <bit>
+#include <map>
+#include <span>
+#include <array>
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <algorithm>
+#include <typeinfo>
+#include <stdexcept>
+#include <filesystem>
+#include <type_traits>
+
+#include "owrt.hpp"
+
+#include "bvh.hpp"
+#include "mesh.hpp"
+#include "camera.hpp"
+#include "render.hpp"
+#include "sphere.hpp"
+#include "triangle.hpp"
+
+/*
+Binary scene files:
+    - A header, a table of sections and the sections, each starting on a 64 byte boundary,
+      little endian and laid out exactly as the structures sit in memory
+    - Sections hold the render settings, the camera, one table per material type, the
+      objects and the meshes they use, and optionally the BVH over the objects and over
+      every mesh, so loading builds nothing
+    - `load` maps the file; mesh arrays are used in place and keep the mapping alive, the
+      rest is copied out in bulk, a few dozen bytes per object
+    - The header carries a fingerprint of the world type and the layouts of the sections'
+      items, since the sections only make sense to a build that lays them out the same
+    - Spheres and triangle meshes are written, instances not yet
+*/
+namespace scenefile
+{
+    struct Header
+    {
+        static constexpr char file_magic[8] = { 'o', 'w', 'r', 't', 's', 'c', 'e', 'n' };
+        static constexpr uint32_t file_version = 1;
+
+        char magic[8];
+        uint32_t version;
+        uint32_t section_count;
+        uint64_t fingerprint;
+    };
+
+    enum class Kind : uint32_t { Settings, Camera, Materials, Objects, Spheres, MeshObjects, Positions, Triangles, Nodes, Order };
+
+    struct Section
+    {
+        static constexpr uint32_t world = ~uint32_t(0);
+
+        Kind kind;
+        uint32_t id;        // the material tag, the mesh, or `world` for the BVH over the objects
+        uint64_t offset;    // from the start of the file
+        uint64_t size;      // in bytes
+    };
+
+    enum class ObjectType : uint32_t { Sphere, TriangleMesh };
+
+    // The world's objects in order, each an index into the section of its type.
+    struct ObjectRef
+    {
+        ObjectType type;
+        uint32_t index;
+    };
+
+    struct MeshObject
+    {
+        uint32_t mesh;
+        dispatch::Handle material;
+    };
+
+    static_assert(sizeof(Header) == 24 && sizeof(Section) == 24, "scene files are read in place");
+
+    constexpr uint64_t alignment = 64;
+
+    template<dispatch::WorldLike TWorld>
+    auto fingerprint() -> uint64_t
+    {
+        auto h = common::hash_combine(0, Header::file_version);
+        for (auto c : std::string_view { typeid(TWorld).name() }) h = common::hash_combine(h, uint8_t(c));
+
+        // the layouts of what is read in place, which the names do not pin down: `-DOWRT_SIMD`
+        // changes them under the same types
+        auto layout = [&]<typename... T>() { ((h = common::hash_combine(h, sizeof(T), alignof(T))), ...); };
+        layout.template operator()<Header, Section, ObjectRef, MeshObject, render::Settings,
+            camera::SimpleCamera<TWorld>, object::Sphere<TWorld>, mesh::Position, mesh::Triangle,
+            typename bvh::Bvh<typename TWorld::Num>::Node, bvh::Bvh<float>::Node>();
+        typename TWorld::MatTables {}.each_table([&]<typename T>(std::span<T const>) { layout.template operator()<T>(); });
+        return h;
+    }
+
+    template<dispatch::WorldLike TWorld>
+    struct Loaded
+    {
+        camera::SimpleCamera<TWorld> camera;
+        render::Settings settings;
+    };
+
+    // Writes `world` with its camera and settings. With `accel`, the BVH over the objects
+    // (when the world keeps a `bvh::Bvh`) and those of the meshes go along.
+    template<class TList>
+    void write(std::filesystem::path const& path, TList const& world, camera::SimpleCamera<typename TList::World> const& cam,
+        render::Settings const& settings, bool accel = true)
+    {
+        using World = typename TList::World;
+        using Sphere = object::Sphere<World>;
+        using TriangleMesh = object::TriangleMesh<World>;
+
+        std::vector<Section> sections;
+        std::vector<std::vector<std::byte>> payloads;
+        auto add = [&]<typename T>(Kind kind, uint32_t id, std::span<T const> items) {
+            static_assert(std::is_trivially_copyable_v<T>, "sections are raw bytes");
+            sections.push_back({ kind, id, 0, items.size_bytes() });
+            auto bytes = std::as_bytes(items);
+            payloads.emplace_back(bytes.begin(), bytes.end());
+        };
+        auto add_one = [&](Kind kind, auto const& item) { add(kind, 0, std::span { &item, 1 }); };
+        auto add_bvh = [&](uint32_t id, auto const& bvh) {
+            add(Kind::Nodes, id, bvh.nodes());
+            add(Kind::Order, id, bvh.order());
+        };
+
+        add_one(Kind::Settings, settings);
+        add_one(Kind::Camera, cam);
+        world.materials.each_table([&]<typename T>(std::span<T const> table) {
+            add(Kind::Materials, TList::MatTables::template tag_of<T>, table);
+        });
+
+        std::vector<ObjectRef> refs;
+        std::vector<Sphere> spheres;
+        std::vector<MeshObject> mesh_objects;
+        std::map<mesh::Mesh const*, uint32_t> mesh_ids;
+        std::vector<mesh::Mesh const*> meshes;
+        for (auto const& object : world.objects)
+            std::visit([&]<typename T>(T const& o) {
+                if constexpr (std::same_as<T, Sphere>) {
+                    refs.push_back({ ObjectType::Sphere, uint32_t(spheres.size()) });
+                    spheres.push_back(o);
+                } else if constexpr (std::same_as<T, TriangleMesh>) {
+                    auto [it, added] = mesh_ids.try_emplace(o.mesh.get(), uint32_t(meshes.size()));
+                    if (added) meshes.push_back(o.mesh.get());
+                    refs.push_back({ ObjectType::TriangleMesh, uint32_t(mesh_objects.size()) });
+                    mesh_objects.push_back({ it->second, o.material });
+                } else {
+                    throw std::invalid_argument("scene files hold spheres and triangle meshes only");
+                }
+            }, object);
+
+        add(Kind::Objects, 0, std::span<ObjectRef const> { refs });
+        add(Kind::Spheres, 0, std::span<Sphere const> { spheres });
+        add(Kind::MeshObjects, 0, std::span<MeshObject const> { mesh_objects });
+        for (uint32_t m = 0; m < meshes.size(); ++m) {
+            add(Kind::Positions, m, meshes[m]->positions());
+            add(Kind::Triangles, m, meshes[m]->triangles());
+            if (accel) add_bvh(m, meshes[m]->bvh());
+        }
+        if constexpr (requires { { world.accel } -> std::convertible_to<bvh::Bvh<typename World::Num> const&>; })
+            if (accel && !world.accel.nodes().empty()) add_bvh(Section::world, world.accel);
+
+        Header header;
+        std::memcpy(header.magic, Header::file_magic, sizeof(header.magic));
+        header.version = Header::file_version;
+        header.section_count = uint32_t(sections.size());
+        header.fingerprint = fingerprint<World>();
+
+        auto align = [](uint64_t n) { return (n + alignment - 1) / alignment * alignment; };
+        auto offset = align(sizeof(Header) + sections.size() * sizeof(Section));
+        for (auto& section : sections) {
+            section.offset = offset;
+            offset = align(offset + section.size);
+        }
+
+        std::ofstream out(path, std::ios::binary);
+        out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+        out.write(reinterpret_cast<char const*>(sections.data()), std::streamsize(sections.size() * sizeof(Section)));
+        for (size_t i = 0; i < sections.size(); ++i) {
+            std::vector<char> pad(sections[i].offset - uint64_t(out.tellp()));
+            out.write(pad.data(), std::streamsize(pad.size()));
+            out.write(reinterpret_cast<char const*>(payloads[i].data()), std::streamsize(payloads[i].size()));
+        }
+        if (!out) throw std::runtime_error("can not write " + path.string());
+    }
+
+    // The sections of a mapped scene file, checked against its size as they are looked up.
+    class Reader
+    {
+        std::filesystem::path _path;
+        std::span<std::byte const> _bytes;
+        std::vector<Section> _sections;
+
+        public:
+            Reader(std::filesystem::path path, std::span<std::byte const> bytes, uint64_t fingerprint)
+                : _path { std::move(path) }, _bytes { bytes }
+            {
+                Header header;
+                if (bytes.size() < sizeof(Header)) throw bad("too short for a scene header");
+                std::memcpy(&header, bytes.data(), sizeof(Header));
+                if (std::memcmp(header.magic, Header::file_magic, sizeof(header.magic)) != 0) throw bad("not a scene file");
+                if (header.version != Header::file_version) throw bad("unsupported scene version");
+                if (header.fingerprint != fingerprint) throw bad("written by a build with other world types");
+                if (bytes.size() < sizeof(Header) + uint64_t(header.section_count) * sizeof(Section)) throw bad("section table past its end");
+
+                _sections.resize(header.section_count);
+                std::memcpy(_sections.data(), bytes.data() + sizeof(Header), _sections.size() * sizeof(Section));
+                for (auto const& s : _sections)
+                    if (s.offset % alignment != 0 || s.offset > bytes.size() || s.size > bytes.size() - s.offset)
+                        throw bad("section out of bounds");
+            }
+
+            auto bad(char const* why) const -> std::runtime_error { return std::runtime_error(_path.string() + ": " + why); }
+
+            auto has(Kind kind, uint32_t id = 0) const -> bool
+            {
+                return std::ranges::any_of(_sections, [&](Section const& s) { return s.kind == kind && s.id == id; });
+            }
+
+            // A section's items where they sit in the mapping, none when there is no such section.
+            template<typename T>
+            auto items(Kind kind, uint32_t id = 0) const -> std::span<T const>
+            {
+                auto it = std::ranges::find_if(_sections, [&](Section const& s) { return s.kind == kind && s.id == id; });
+                if (it == _sections.end()) return {};
+                if (it->size % sizeof(T) != 0) throw bad("section size is not a whole number of items");
+                return { reinterpret_cast<T const*>(_bytes.data() + it->offset), it->size / sizeof(T) };
+            }
+
+            // A section holding exactly one `T`, copied out.
+            template<typename T>
+            auto one(Kind kind) const -> T
+            {
+                auto it = std::ranges::find_if(_sections, [&](Section const& s) { return s.kind == kind; });
+                if (it == _sections.end() || it->size != sizeof(T)) throw bad("missing its settings or camera");
+                std::array<std::byte, sizeof(T)> raw;
+                std::memcpy(raw.data(), _bytes.data() + it->offset, sizeof(T));
+                return std::bit_cast<T>(raw);
+            }
+
+            template<std::floating_point TNum>
+            auto bvh(uint32_t id) const -> std::optional<bvh::Bvh<TNum>>
+            {
+                auto nodes = items<typename bvh::Bvh<TNum>::Node>(Kind::Nodes, id);
+                if (nodes.empty()) return std::nullopt;
+                try {
+                    return bvh::Bvh<TNum>::adopt(nodes, items<uint32_t>(Kind::Order, id));
+                } catch (std::invalid_argument const&) {
+                    throw bad("bvh does not fit its primitives");
+                }
+            }
+    };
+
+    /*
+    Loads a scene file into `world`, which has to be empty, throwing `std::runtime_error`
+    when the file is not one this build can read:
+        - The objects go into `world` in the order they were written, so a BVH written
+          with them still fits; it is adopted when `world` keeps a `bvh::Bvh`, otherwise
+          `world` is built as usual
+        - Materials keep the handles they had, their tables being written without repeats
+    */
+    template<class TList>
+    auto load(std::filesystem::path const& path, TList& world) -> Loaded<typename TList::World>
+    {
+        using World = typename TList::World;
+        using Num = typename World::Num;
+        using Sphere = object::Sphere<World>;
+        using TriangleMesh = object::TriangleMesh<World>;
+
+        if (!world.objects.empty() || world.materials.size() > 0) throw std::invalid_argument("scene files load into an empty world");
+
+        auto file = std::make_shared<mesh::MappedFile const>(path);
+        Reader in { path, file->bytes(), fingerprint<World>() };
+
+        Loaded<World> loaded {
+            in.one<camera::SimpleCamera<World>>(Kind::Camera),
+            in.one<render::Settings>(Kind::Settings),
+        };
+        auto const& s = loaded.settings;
+        if (std::min({ s.width, s.height }) < 2 || std::min({ s.samples_per_pixel, s.samples_per_iter, s.max_depth }) < 1)
+            throw in.bad("render settings out of range");
+
+        world.materials.each_table([&]<typename T>(std::span<T const>) {
+            constexpr auto tag = TList::MatTables::template tag_of<T>;
+            auto table = in.items<T>(Kind::Materials, tag);
+            for (uint32_t i = 0; i < table.size(); ++i)
+                if (world.materials.add(table[i]) != dispatch::Handle { tag, i }) throw in.bad("repeated material");
+        });
+        auto check = [&](dispatch::Handle h) {
+            if (!world.materials.contains(h)) throw in.bad("object refers past the materials");
+        };
+
+        std::vector<std::shared_ptr<mesh::Mesh const>> meshes;
+        for (uint32_t m = 0; in.has(Kind::Positions, m); ++m)
+            meshes.push_back(mesh::Mesh::view(file,
+                in.items<mesh::Position>(Kind::Positions, m), in.items<mesh::Triangle>(Kind::Triangles, m), in.bvh<float>(m)));
+
+        auto refs = in.items<ObjectRef>(Kind::Objects);
+        auto spheres = in.items<Sphere>(Kind::Spheres);
+        auto mesh_objects = in.items<MeshObject>(Kind::MeshObjects);
+        world.objects.reserve(refs.size());
+        for (auto ref : refs)
+        {
+            if (ref.type == ObjectType::Sphere && ref.index < spheres.size()) {
+                auto sphere = spheres[ref.index];
+                check(sphere.material);
+                world.template add<object::Sphere>(std::move(sphere));
+            } else if (ref.type == ObjectType::TriangleMesh && ref.index < mesh_objects.size()) {
+                auto o = mesh_objects[ref.index];
+                if (o.mesh >= meshes.size()) throw in.bad("object refers past the meshes");
+                check(o.material);
+                world.template add<object::TriangleMesh>(TriangleMesh { meshes[o.mesh], o.material });
+            } else {
+                throw in.bad("object of unknown type or past its section");
+            }
+        }
+
+        if constexpr (requires { typename TList::Accel; world.build(); })
+        {
+            if constexpr (std::same_as<typename TList::Accel, bvh::Bvh<Num>>)
+                if (auto bvh = in.bvh<Num>(Section::world)) {
+                    if (bvh->order().size() != world.objects.size()) throw in.bad("bvh is over other objects");
+                    world.accel = std::move(*bvh);
+                    return loaded;
+                }
+            world.build();
+        }
+        return loaded;
+    }
+}
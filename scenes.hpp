@@ -0,0 +1,313 @@
+#pragma once
+
+#include "owrt.hpp"
+
+#include "sphere.hpp"
+#include "triangle.hpp"
+#include "instance.hpp"
+#include "camera.hpp"
+#include "baked.hpp"
+
+namespace scenes
+{
+    using common::rand;
+
+    template<class World>
+    auto five_spheres_camera(typename World::Num aspect_ratio)
+    {
+        using Num = typename World::Num;
+        using Loc = typename World::Loc;
+        using Vec = typename World::Vec;
+
+        Loc look_from {3,3,2};
+        Loc look_to {0,0,-1};
+        Num dist_to_focus = (look_from-Loc{-1,0,-1}).length();
+        Num aperture = 0.5;
+
+        return camera::SimpleCamera<World>(
+            look_from, look_to, Vec::Up,
+            20, aspect_ratio,
+            aperture, dist_to_focus);
+    }
+
+    // The scene of `five_spheres` as a `baked::Description`, which `five_spheres` adds to a
+    // list and a `baked::Scene` bakes in.
+    template<class World>
+    constexpr baked::Description five_spheres_baked {
+        std::tuple {
+            material::Lambertian<World>{{0.8, 0.8, 0.0}},
+            material::Lambertian<World>{{0.1, 0.2, 0.5}},
+            material::Dielectric<World>{1.5},
+            material::Metal<World>{{0.8, 0.6, 0.2}, 0.0},
+        },
+        std::array<baked::Sphere<World>, 5> {{
+            {{ 0,-100.5,-1}, 100, 0},
+            {{ 0, 0,-1},  0.5, 1},
+            {{-1, 0,-1},  0.5, 2},
+            {{-1, 0,-1}, -0.4, 2},
+            {{ 1, 0,-1},  0.5, 3},
+        }},
+    };
+
+    template<class World>
+    auto five_spheres(object::HittableList<World>& world, typename World::Num aspect_ratio)
+    {
+        baked::add_to(world, five_spheres_baked<World>);
+        return five_spheres_camera<World>(aspect_ratio);
+    }
+
+    template<class World>
+    auto random_scene(object::HittableList<World>& world, typename World::Num aspect_ratio, int extent = 11)
+    {
+        using Num = typename World::Num;
+        using Loc = typename World::Loc;
+        using Vec = typename World::Vec;
+        using Color = typename World::Color;
+
+        using Lambertian = material::Lambertian<World>;
+        using Metal = material::Metal<World>;
+        using Dielectric = material::Dielectric<World>;
+
+        common::RandomState rs;
+
+        // the grid of small spheres, the ground and the three large ones
+        world.objects.reserve(world.objects.size() + 4 * size_t(extent) * extent + 4);
+
+        auto ground_material = world.materials.add(Lambertian{{0.5, 0.5, 0.5}});
+        world.template add<object::Sphere>({{0,-1000,0}, 1000, ground_material});
+
+        for (int a = -extent; a < extent; a++) {
+            for (int b = -extent; b < extent; b++) {
+                auto choose_mat = rand<Num>(rs);
+                Loc center { a + Num(0.6)*rand<Num>(rs), Num(0.2), b + Num(0.6)*rand<Num>(rs) };
+
+                if ((center - Loc{4, 0.2, 0}).length() > 0.9) {
+                    if (choose_mat < 0.8) {
+                        // diffuse
+                        auto albedo = rand<Color>(rs) * rand<Color>(rs);
+                        auto sphere_material = world.materials.add(Lambertian{ albedo });
+                        world.template add<object::Sphere>({center, 0.2, sphere_material});
+                    } else if (choose_mat < 0.95) {
+                        // metal
+                        auto albedo = rand<Color>(rs, 0.5, 1);
+                        auto fuzz = rand<Num>(rs, 0, 0.5);
+                        auto sphere_material = world.materials.add(Metal{albedo, fuzz});
+                        world.template add<object::Sphere>({center, 0.2, sphere_material});
+                    } else {
+                        // glass
+                        auto sphere_material = world.materials.add(Dielectric{1.5});
+                        world.template add<object::Sphere>({center, 0.2, sphere_material});
+                    }
+                }
+            }
+        }
+
+        auto material1 = world.materials.add(Dielectric{1.5});
+        world.template add<object::Sphere>({{0, 1, 0}, 1.0, material1});
+
+        auto material2 = world.materials.add(Lambertian{{0.4, 0.2, 0.1}});
+        world.template add<object::Sphere>({{-4, 1, 0}, 1.0, material2});
+
+        auto material3 = world.materials.add(Metal{{0.7, 0.6, 0.5}, 0.0});
+        world.template add<object::Sphere>({{4, 1, 0}, 1.0, material3});
+
+        Loc look_from {13,2,3};
+        Loc look_to {0,0,0};
+        Num dist_to_focus = 10;
+        Num aperture = 0.1;
+
+        return camera::SimpleCamera<World>(
+            look_from, look_to, Vec::Up,
+            20, aspect_ratio,
+            aperture, dist_to_focus);
+    }
+
+    // Indoor lighting: a closed room lit only by a small, bright lamp.
+    template<class World>
+    auto lamp_spheres(object::HittableList<World>& world, typename World::Num aspect_ratio)
+    {
+        using Num = typename World::Num;
+        using Loc = typename World::Loc;
+        using Vec = typename World::Vec;
+
+        using Emissive = material::Emissive<World>;
+        using Lambertian = material::Lambertian<World>;
+        using Metal = material::Metal<World>;
+        using Dielectric = material::Dielectric<World>;
+
+        auto material_room   = world.materials.add(Lambertian{{0.7, 0.7, 0.7}});
+        auto material_ground = world.materials.add(Lambertian{{0.5, 0.4, 0.3}});
+        auto material_center = world.materials.add(Lambertian{{0.1, 0.2, 0.5}});
+        auto material_left   = world.materials.add(Dielectric{1.5});
+        auto material_right  = world.materials.add(Metal{{0.8, 0.6, 0.2}, 0.1});
+        auto material_lamp   = world.materials.add(Emissive{{40, 36, 30}});
+
+        world.template add<object::Sphere>({{ 0, 0, 0}, 20, material_room});
+        world.template add<object::Sphere>({{ 0,-100.5,-1}, 100, material_ground});
+        world.template add<object::Sphere>({{ 0, 0,-1},  0.5, material_center});
+        world.template add<object::Sphere>({{-1, 0,-1},  0.5, material_left});
+        world.template add<object::Sphere>({{ 1, 0,-1},  0.5, material_right});
+        world.template add<object::Sphere>({{ 0.5, 1.2, -0.2}, 0.15, material_lamp});
+
+        Loc look_from {3,2,2};
+        Loc look_to {0,0,-1};
+        Num dist_to_focus = (look_from-look_to).length();
+        Num aperture = 0;
+
+        return camera::SimpleCamera<World>(
+            look_from, look_to, Vec::Up,
+            30, aspect_ratio,
+            aperture, dist_to_focus);
+    }
+
+    // Many small lamps of different colors hanging over a floor, for light selection.
+    template<class World>
+    auto many_lamps(object::HittableList<World>& world, typename World::Num aspect_ratio, int extent = 10)
+    {
+        using Num = typename World::Num;
+        using Loc = typename World::Loc;
+        using Vec = typename World::Vec;
+        using Color = typename World::Color;
+
+        using Emissive = material::Emissive<World>;
+        using Lambertian = material::Lambertian<World>;
+        using Metal = material::Metal<World>;
+
+        common::RandomState rs;
+
+        world.objects.reserve(world.objects.size() + 4 * size_t(extent) * extent + 4);
+
+        world.template add<object::Sphere>({{0, 0, 0}, 50, world.materials.add(Lambertian{{0.3, 0.3, 0.3}})});
+        world.template add<object::Sphere>({{0, -1000, 0}, 1000, world.materials.add(Lambertian{{0.6, 0.6, 0.6}})});
+        world.template add<object::Sphere>({{-1.5, 1, 0}, 1, world.materials.add(Lambertian{{0.7, 0.3, 0.2}})});
+        world.template add<object::Sphere>({{1.5, 1, 0}, 1, world.materials.add(Metal{{0.8, 0.8, 0.8}, 0.05})});
+
+        for (int a = -extent; a < extent; a++) {
+            for (int b = -extent; b < extent; b++) {
+                Loc center { a + Num(0.5) + Num(0.3)*rand<Num>(rs), Num(0.3) + Num(2.5)*rand<Num>(rs), b + Num(0.5) + Num(0.3)*rand<Num>(rs) };
+                auto emit = Num(6) * rand<Color>(rs, 0.2, 1);
+                world.template add<object::Sphere>({center, 0.05, world.materials.add(Emissive{ emit })});
+            }
+        }
+
+        Loc look_from {0, 4, 9};
+        Loc look_to {0, 0.8, 0};
+        Num dist_to_focus = (look_from-look_to).length();
+        Num aperture = 0;
+
+        return camera::SimpleCamera<World>(
+            look_from, look_to, Vec::Up,
+            40, aspect_ratio,
+            aperture, dist_to_focus);
+    }
+
+    // A lamp sealed in a glass sphere: shadow rays never reach it, so all of its light
+    // has to be found by scattering through the glass.
+    template<class World>
+    auto glass_lamp(object::HittableList<World>& world, typename World::Num aspect_ratio)
+    {
+        using Num = typename World::Num;
+        using Loc = typename World::Loc;
+        using Vec = typename World::Vec;
+
+        using Emissive = material::Emissive<World>;
+        using Lambertian = material::Lambertian<World>;
+        using Metal = material::Metal<World>;
+        using Dielectric = material::Dielectric<World>;
+
+        world.template add<object::Sphere>({{0, 0, 0}, 20, world.materials.add(Lambertian{{0.5, 0.5, 0.5}})});
+        world.template add<object::Sphere>({{0, -1000, 0}, 1000, world.materials.add(Lambertian{{0.6, 0.6, 0.6}})});
+        world.template add<object::Sphere>({{-1.2, 0.5, -0.3}, 0.5, world.materials.add(Lambertian{{0.6, 0.2, 0.1}})});
+        world.template add<object::Sphere>({{1.2, 0.5, 0.2}, 0.5, world.materials.add(Metal{{0.8, 0.8, 0.8}, 0.2})});
+        world.template add<object::Sphere>({{0, 1.6, 0}, 0.35, world.materials.add(Dielectric{1.5})});
+        world.template add<object::Sphere>({{0, 1.6, 0}, 0.25, world.materials.add(Emissive{{16, 14, 12}})});
+
+        Loc look_from {0, 2, 6};
+        Loc look_to {0, 0.8, 0};
+        Num dist_to_focus = (look_from-look_to).length();
+        Num aperture = 0;
+
+        return camera::SimpleCamera<World>(
+            look_from, look_to, Vec::Up,
+            40, aspect_ratio,
+            aperture, dist_to_focus);
+    }
+
+    // Glass and diffuse meshes under a lamp, the glass one mapped from `glass_mesh`.
+    template<class World>
+    auto mesh_lamp(object::HittableList<World>& world, typename World::Num aspect_ratio, std::filesystem::path const& glass_mesh)
+    {
+        using Num = typename World::Num;
+        using Loc = typename World::Loc;
+        using Vec = typename World::Vec;
+
+        using Emissive = material::Emissive<World>;
+        using Lambertian = material::Lambertian<World>;
+        using Dielectric = material::Dielectric<World>;
+
+        auto [positions, triangles] = mesh::icosphere(1, { 0.8f, 0.5f, -0.2f }, 0.5f);
+        auto faceted = mesh::Mesh::from(std::move(positions), std::move(triangles));
+
+        world.template add<object::Sphere>({{0, 0, 0}, 20, world.materials.add(Lambertian{{0.5, 0.5, 0.5}})});
+        world.template add<object::Sphere>({{0, -1000, 0}, 1000, world.materials.add(Lambertian{{0.6, 0.6, 0.6}})});
+        world.template add<object::TriangleMesh>({mesh::Mesh::map(glass_mesh), world.materials.add(Dielectric{1.5})});
+        world.template add<object::TriangleMesh>({faceted, world.materials.add(Lambertian{{0.2, 0.4, 0.7}})});
+        world.template add<object::Sphere>({{-0.5, 2.2, 0.8}, 0.2, world.materials.add(Emissive{{30, 27, 24}})});
+
+        Loc look_from {0, 2, 5};
+        Loc look_to {0, 0.5, 0};
+        Num dist_to_focus = (look_from-look_to).length();
+        Num aperture = 0;
+
+        return camera::SimpleCamera<World>(
+            look_from, look_to, Vec::Up,
+            35, aspect_ratio,
+            aperture, dist_to_focus);
+    }
+
+    // Copies of one small prototype scattered over a floor, each turned and scaled on its own.
+    template<class World>
+    auto instances(object::HittableList<World>& world, typename World::Num aspect_ratio, int extent = 10)
+    {
+        using Num = typename World::Num;
+        using Loc = typename World::Loc;
+        using Vec = typename World::Vec;
+        using Transform = vmath::Transform<Num>;
+
+        using Lambertian = material::Lambertian<World>;
+        using Metal = material::Metal<World>;
+        using Dielectric = material::Dielectric<World>;
+
+        common::RandomState rs;
+
+        // a faceted ball resting on the floor, with a mirror bead and a glass bead on top
+        auto [positions, triangles] = mesh::icosphere(1, { 0, 0.3f, 0 }, 0.3f);
+        auto prototype = std::make_shared<object::BvhList<World>>();
+        prototype->template add<object::TriangleMesh>({mesh::Mesh::from(std::move(positions), std::move(triangles)), world.materials.add(Lambertian{{0.7, 0.35, 0.1}})});
+        prototype->template add<object::Sphere>({{0.12, 0.65, 0}, 0.1, world.materials.add(Metal{{0.9, 0.9, 0.9}, 0.0})});
+        prototype->template add<object::Sphere>({{-0.12, 0.65, 0}, 0.1, world.materials.add(Dielectric{1.5})});
+        prototype->build();
+
+        world.template add<object::Sphere>({{0, -1000, 0}, 1000, world.materials.add(Lambertian{{0.5, 0.5, 0.5}})});
+
+        memory::Shared<object::InstanceTable<World>> table { std::make_shared<object::InstanceTable<World>>() };
+        for (int a = -extent; a < extent; a++) {
+            for (int b = -extent; b < extent; b++) {
+                auto turn = Transform::rotate(Vec::Up, 360 * rand<Num>(rs));
+                auto size = Transform::scale(rand<Num>(rs, 0.6, 1.2));
+                auto place = Transform::translate({ a + Num(0.5), 0, b + Num(0.5) });
+                world.template add<object::Instance>(object::Instance<World>::place(table, prototype, place * turn * size));
+            }
+        }
+
+        Loc look_from {4, 3, 6};
+        Loc look_to {0, 0.3, 0};
+        Num dist_to_focus = (look_from-look_to).length();
+        Num aperture = 0;
+
+        return camera::SimpleCamera<World>(
+            look_from, look_to, Vec::Up,
+            30, aspect_ratio,
+            aperture, dist_to_focus);
+    }
+}
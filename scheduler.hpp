@@ -42,6 +42,13 @@ namespace scheduler
 
                 std::swap(_current, _next);
             }
+
+            // Runs everything scheduled so far to completion.
+            inline void flush()
+            {
+                wait();
+                wait();
+            }
     };
 
     template <size_t NThreadCount, class TThreadLocal>
@@ -129,6 +136,11 @@ namespace scheduler
 
                 inline ~ThreadBlock()
                 {
+                    {
+                        // under the lock so the worker either sees the stop or is already waiting
+                        std::lock_guard const lock { workLock };
+                        thread.request_stop();
+                    }
                     workCondition.notify_all();
                 }
             };
@@ -183,5 +195,12 @@ namespace scheduler
                     b->workCondition.notify_all();
                 }
             }
+
+            // Runs everything scheduled so far to completion.
+            inline void flush()
+            {
+                wait();
+                wait();
+            }
     };
 }
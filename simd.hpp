@@ -0,0 +1,94 @@
+#pragma once
+
+#include <bit>
+#include <concepts>
+#include <cstdint>
+#include <utility>
+#include <type_traits>
+
+/*
+Optional SIMD backend for the 3-tuples in `vmath` and `color`:
+    - Enabled by building with `-DOWRT_SIMD`
+    - Floating point tuples are padded to 4 lanes and aligned to the lane width,
+      so a tuple is loaded and stored as a single register (SSE for float,
+      AVX for double)
+    - Uses the GCC vector extensions instead of intrinsics so `-march` picks the width
+    - Constant evaluation always takes the scalar path
+    - Not bit identical to the scalar build: dot products add their lanes in another
+      order and contract differently into FMAs, so a few golden scenes (five_spheres,
+      many_lamps, the photon and mesh scenes) only pass within the golden tolerance,
+      a mean channel error of a few thousandths
+*/
+namespace simd
+{
+#ifdef OWRT_SIMD
+    constexpr bool enabled = true;
+#else
+    constexpr bool enabled = false;
+#endif
+
+    template<typename TNum>
+    constexpr bool lanes_for = enabled and std::floating_point<TNum>;
+
+    template<typename TNum>
+    using Lanes [[gnu::vector_size(4 * sizeof(TNum))]] = TNum;
+
+    template<typename TNum>
+    constexpr auto alignment = lanes_for<TNum> ? sizeof(Lanes<TNum>) : alignof(TNum);
+
+    // The fourth lane, kept zero by construction; empty when the backend is off.
+    template<typename TNum, bool = lanes_for<TNum>>
+    struct Pad
+    {
+        TNum w = 0;
+
+        constexpr bool operator==(Pad const&) const { return true; }
+    };
+    template<typename TNum>
+    struct Pad<TNum, false>
+    {
+        constexpr bool operator==(Pad const&) const { return true; }
+    };
+
+    template<typename T>
+    concept Packed = lanes_for<typename T::Num>
+        and sizeof(T) == sizeof(Lanes<typename T::Num>)
+        and std::is_trivially_copyable_v<T>;
+
+    template<Packed T>
+    inline auto load(T const& t)
+    {
+        return std::bit_cast<Lanes<typename T::Num>>(t);
+    }
+
+    template<Packed T>
+    inline auto store(Lanes<typename T::Num> v) -> T
+    {
+        return std::bit_cast<T>(v);
+    }
+
+    template<typename TNum>
+    inline auto splat(TNum n) -> Lanes<TNum>
+    {
+        return Lanes<TNum> {} + n;
+    }
+
+    // Lane types can not be deduced through the alias, so these take the vector itself.
+    template<typename TLanes>
+    using LaneNum = std::remove_cvref_t<decltype(std::declval<TLanes>()[0])>;
+
+    // Sum of the first three lanes, the padding lane is ignored.
+    template<typename TLanes>
+    inline auto sum3(TLanes v) -> LaneNum<TLanes>
+    {
+        return v[0] + v[1] + v[2];
+    }
+
+    // (x, y, z, w) -> (y, z, x, w)
+    template<typename TLanes>
+    inline auto rotate3(TLanes v) -> TLanes
+    {
+        using Mask = Lanes<std::conditional_t<sizeof(LaneNum<TLanes>) == 8, int64_t, int32_t>>;
+        return __builtin_shuffle(v, Mask { 1, 2, 0, 3 });
+    }
+}
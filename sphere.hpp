@@ -1,6 +1,7 @@
 #pragma once
 
 #include "hittable.hpp"
+#include "bounds.hpp"
 
 namespace object
 {
@@ -12,14 +13,14 @@ namespace object
             using Num = typename World::Num;
             using Loc = typename World::Loc;
             using Ray = typename World::Ray;
-            using MatVar = typename World::MatVar;
             using HitRec = HitRecord<World>;
+            using Query = HitQuery<World>;
 
             Loc center;
             Num radius;
-            MatVar material;
+            Handle material;
 
-            constexpr auto hit(vmath::RaySegLike auto seg) const -> std::optional<HitRec>
+            constexpr auto intersect(vmath::RaySegLike auto seg) const -> std::optional<Query>
             {
                 auto const& [r, t_min, t_max] = seg;
 
@@ -28,26 +29,58 @@ namespace object
                 auto half_b = dot(oc, r.direction);
                 auto c = oc.length_squared() - radius*radius;
 
-                auto discriminant = half_b*half_b - a*c;
+                // Discriminant from the distance between the center and the ray's line,
+                // avoids the cancellation in half_b*half_b - a*c for distant or small spheres.
+                auto l = oc - (half_b / a) * r.direction;
+                auto discriminant = a * (radius*radius - l.length_squared());
                 if (discriminant < 0) return std::nullopt;
-                auto sqrtd = sqrt(discriminant);
+                auto sqrtd = std::sqrt(discriminant);
 
                 // Find the nearest root that lies in the acceptable range.
-                auto root = (-half_b - sqrtd) / a;
-                if (root < t_min || t_max < root) {
-                    root = (-half_b + sqrtd) / a;
-                    if (root < t_min || t_max < root)
+                auto q = -(half_b + std::copysign(sqrtd, half_b));
+                auto root0 = c / q;
+                auto root1 = q / a;
+                if (root0 > root1) std::swap(root0, root1);
+
+                // Written so a NaN root (q == 0 on a grazing ray) is rejected too.
+                auto root = root0;
+                if (!(t_min < root && root <= t_max)) {
+                    root = root1;
+                    if (!(t_min < root && root <= t_max))
                         return std::nullopt;
                 }
 
+                return Query { root };
+            }
+
+            constexpr auto occluded(vmath::RaySegLike auto seg) const -> bool
+            {
+                return intersect(seg).has_value();
+            }
+
+            constexpr auto surface(Ray const& r, Query const& q) const -> HitRec
+            {
                 HitRec rec;
-                rec.t = root;
-                rec.point = r.at(rec.t);
-                auto outward_normal = (rec.point - center) / radius;
+                rec.t = q.t;
+                auto local = r.at(rec.t) - center;
+                // Reproject onto the surface, leaving only the error of the projection itself.
+                local *= std::abs(radius) / local.length();
+                rec.point = center + local;
+                rec.error = common::gamma<Num>(5) * vmath::abs(local) + common::gamma<Num>(1) * vmath::abs(affine(center));
+                auto outward_normal = local / radius;
                 rec.set_face_normal(r, outward_normal);
-                rec.material = &material;
+                rec.material = material;
 
                 return rec;
             }
+
+            constexpr auto hit(vmath::RaySegLike auto seg) const -> std::optional<HitRec>
+            {
+                if (auto q = intersect(seg); q)
+                    return surface(seg.ray, *q);
+                return std::nullopt;
+            }
+
+            constexpr auto bounds() const { return vmath::Bounds3<Num>::around(center, radius); }
     };
 }
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <utility>
+
+#include "vmath.hpp"
+#include "bounds.hpp"
+
+namespace vmath
+{
+    // x -> linear * x + translation, the linear part kept as rows.
+    template<std::floating_point TNum>
+    struct Affine3
+    {
+        using Num = TNum;
+        using Vec = Vec3<Num>;
+        using Loc = Loc3<Num>;
+
+        std::array<Vec, 3> rows { Vec { 1, 0, 0 }, Vec { 0, 1, 0 }, Vec { 0, 0, 1 } };
+        Vec translation {};
+
+        constexpr auto linear(Vec const& v) const { return Vec { dot(rows[0], v), dot(rows[1], v), dot(rows[2], v) }; }
+        constexpr auto operator()(Vec const& v) const { return linear(v); }
+        constexpr auto operator()(Loc const& p) const
+        {
+            auto v = linear(affine(p)) + translation;
+            return Loc { v.x, v.y, v.z };
+        }
+
+        // `a` after `b`
+        friend constexpr auto operator*(Affine3 const& a, Affine3 const& b) -> Affine3
+        {
+            Affine3 c;
+            for (auto i = 0; i < 3; ++i)
+                c.rows[i] = a.rows[i].x * b.rows[0] + a.rows[i].y * b.rows[1] + a.rows[i].z * b.rows[2];
+            c.translation = a.linear(b.translation) + a.translation;
+            return c;
+        }
+    };
+
+    /*
+    Affine transform with its inverse:
+        - Built from translations, scales and rotations, each of which knows its inverse
+          exactly, so nothing is ever inverted numerically
+        - Normals go through the inverse transpose of the linear part
+        - `to_world` carries a point's error bound along, as pbrt does
+    */
+    template<std::floating_point TNum>
+    struct Transform
+    {
+        using Num = TNum;
+        using Vec = Vec3<Num>;
+        using Loc = Loc3<Num>;
+        using Matrix = Affine3<Num>;
+
+        Matrix forward;
+        Matrix inverse;
+
+        static constexpr auto translate(Vec const& d) -> Transform
+        {
+            return { { .translation = d }, { .translation = -d } };
+        }
+
+        static constexpr auto scale(Num s) -> Transform
+        {
+            Transform t;
+            for (auto i = 0; i < 3; ++i) {
+                t.forward.rows[i] *= s;
+                t.inverse.rows[i] *= 1 / s;
+            }
+            return t;
+        }
+
+        // Counter clockwise by `degrees` around `axis`, looking down it.
+        static auto rotate(Vec const& axis, Num degrees) -> Transform
+        {
+            auto a = unit_vector(axis);
+            auto theta = common::degrees_to_radians(degrees);
+            auto s = std::sin(theta), c = std::cos(theta);
+
+            Transform t;
+            t.forward.rows = {
+                Vec { a.x * a.x + (1 - a.x * a.x) * c, a.x * a.y * (1 - c) - a.z * s, a.x * a.z * (1 - c) + a.y * s },
+                Vec { a.x * a.y * (1 - c) + a.z * s, a.y * a.y + (1 - a.y * a.y) * c, a.y * a.z * (1 - c) - a.x * s },
+                Vec { a.x * a.z * (1 - c) - a.y * s, a.y * a.z * (1 - c) + a.x * s, a.z * a.z + (1 - a.z * a.z) * c },
+            };
+            // a rotation's inverse is its transpose
+            for (auto i = 0; i < 3; ++i)
+                t.inverse.rows[i] = Vec { t.forward.rows[0][i], t.forward.rows[1][i], t.forward.rows[2][i] };
+            return t;
+        }
+
+        // `a` after `b`
+        friend constexpr auto operator*(Transform const& a, Transform const& b) -> Transform
+        {
+            return { a.forward * b.forward, b.inverse * a.inverse };
+        }
+
+        constexpr auto inverted() const -> Transform { return { inverse, forward }; }
+
+        constexpr auto normal_to_world(Vec const& n) const
+        {
+            auto const& r = inverse.rows;
+            return n.x * r[0] + n.y * r[1] + n.z * r[2];
+        }
+
+        // A point and its absolute error bound, with the rounding of the transform itself added.
+        constexpr auto to_world(Loc const& p, Vec const& error) const -> std::pair<Loc, Vec>
+        {
+            auto const& r = forward.rows;
+            Matrix a { { abs(r[0]), abs(r[1]), abs(r[2]) }, {} };
+            auto rounding = common::gamma<Num>(3) * (a.linear(abs(affine(p))) + abs(forward.translation));
+            return { forward(p), (1 + common::gamma<Num>(3)) * a.linear(error) + rounding };
+        }
+
+        constexpr auto to_world(Bounds3<Num> const& b) const
+        {
+            Bounds3<Num> result;
+            if (b.empty()) return result;
+            for (auto corner = 0; corner < 8; ++corner)
+                result.merge(forward(Loc {
+                    corner & 1 ? b.hi.x : b.lo.x,
+                    corner & 2 ? b.hi.y : b.lo.y,
+                    corner & 4 ? b.hi.z : b.lo.z,
+                }));
+            return result;
+        }
+    };
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <memory>
+
+#include "hittable.hpp"
+#include "bounds.hpp"
+#include "mesh.hpp"
+#include "memory.hpp"
+
+namespace object
+{
+    // A shared `mesh::Mesh` with one material. Triangles face the side they wind counter
+    // clockwise from, which is what tells the inside of a closed mesh for `Dielectric`.
+    template<typename TWorld>
+    class TriangleMesh
+    {
+        public:
+            using World = TWorld;
+            using Num = typename World::Num;
+            using Loc = typename World::Loc;
+            using Vec = typename World::Vec;
+            using Ray = typename World::Ray;
+            using HitRec = HitRecord<World>;
+            using Query = HitQuery<World>;
+
+            memory::Shared<mesh::Mesh const> mesh;
+            Handle material;
+
+            constexpr auto intersect(vmath::RaySegLike auto seg) const -> std::optional<Query>
+            {
+                return mesh->bvh().intersect(seg, [&](uint32_t tri, auto const& s) { return intersect_triangle(s, tri); });
+            }
+
+            constexpr auto occluded(vmath::RaySegLike auto seg) const -> bool
+            {
+                return mesh->bvh().occluded(seg, [&](uint32_t tri, auto const& s) { return intersect_triangle(s, tri).has_value(); });
+            }
+
+            constexpr auto surface(Ray const& r, Query const& q) const -> HitRec
+            {
+                auto [p0, p1, p2] = corners(q.sub);
+                auto edge = edges(r, p0, p1, p2);
+                auto b0 = edge.e[0] / edge.det, b1 = edge.e[1] / edge.det, b2 = edge.e[2] / edge.det;
+
+                auto p = b0 * affine(p0) + b1 * affine(p1) + b2 * affine(p2);
+                auto error = common::gamma<Num>(7) * (vmath::abs(b0 * affine(p0)) + vmath::abs(b1 * affine(p1)) + vmath::abs(b2 * affine(p2)));
+
+                HitRec rec;
+                rec.t = q.t;
+                rec.point = Loc { p.x, p.y, p.z };
+                rec.error = error;
+                rec.set_face_normal(r, unit_vector(cross(p1 - p0, p2 - p0)));
+                rec.material = material;
+                return rec;
+            }
+
+            constexpr auto hit(vmath::RaySegLike auto seg) const -> std::optional<HitRec>
+            {
+                if (auto q = intersect(seg); q)
+                    return surface(seg.ray, *q);
+                return std::nullopt;
+            }
+
+            constexpr auto bounds() const
+            {
+                auto b = mesh->bounds();
+                return vmath::Bounds3<Num> { to_loc(b.lo), to_loc(b.hi) };
+            }
+
+        private:
+            static constexpr auto to_loc(auto const& p) { return Loc { Num(p[0]), Num(p[1]), Num(p[2]) }; }
+
+            constexpr auto corners(uint32_t tri) const -> std::array<Loc, 3>
+            {
+                auto [a, b, c] = mesh->vertices(tri);
+                return { to_loc(a), to_loc(b), to_loc(c) };
+            }
+
+            struct Edges
+            {
+                std::array<Vec, 3> p;   // the corners in ray space
+                std::array<Num, 3> e;   // edge functions, the barycentrics times `det`
+                Num det;
+                Num t_scaled;           // the hit distance times `det`
+            };
+
+            /*
+            Watertight ray-triangle test (Woop et al. 2013), as in pbrt:
+                - The corners are moved into a space where the ray starts at the origin and runs
+                  along +z, where the edge functions are 2D cross products of the corners
+                - A ray through an edge or vertex gets a zero edge function on both triangles
+                  that share it rather than missing both
+            */
+            static constexpr auto edges(Ray const& r, Loc const& p0, Loc const& p1, Loc const& p2) -> Edges
+            {
+                auto d = r.direction;
+                auto ad = vmath::abs(d);
+                int kz = ad.x > ad.y ? (ad.x > ad.z ? 0 : 2) : (ad.y > ad.z ? 1 : 2);
+                int kx = (kz + 1) % 3, ky = (kx + 1) % 3;
+
+                auto sx = -d[kx] / d[kz], sy = -d[ky] / d[kz], sz = 1 / d[kz];
+                auto transform = [&](Loc const& p) {
+                    auto o = p - r.origin;
+                    return Vec { o[kx] + sx * o[kz], o[ky] + sy * o[kz], sz * o[kz] };
+                };
+                auto t0 = transform(p0), t1 = transform(p1), t2 = transform(p2);
+
+                std::array<Num, 3> e {
+                    t1.x * t2.y - t1.y * t2.x,
+                    t2.x * t0.y - t2.y * t0.x,
+                    t0.x * t1.y - t0.y * t1.x,
+                };
+                // exact zeros are redone in double, where they usually are not
+                if constexpr (std::same_as<Num, float>)
+                    if (e[0] == 0 || e[1] == 0 || e[2] == 0) {
+                        e[0] = Num(double(t1.x) * double(t2.y) - double(t1.y) * double(t2.x));
+                        e[1] = Num(double(t2.x) * double(t0.y) - double(t2.y) * double(t0.x));
+                        e[2] = Num(double(t0.x) * double(t1.y) - double(t0.y) * double(t1.x));
+                    }
+
+                return { { t0, t1, t2 }, e, e[0] + e[1] + e[2], e[0] * t0.z + e[1] * t1.z + e[2] * t2.z };
+            }
+
+            constexpr auto intersect_triangle(vmath::RaySegLike auto const& seg, uint32_t tri) const -> std::optional<Query>
+            {
+                auto const& [r, t_min, t_max] = seg;
+                auto [p0, p1, p2] = corners(tri);
+                auto [p, e, det, t_scaled] = edges(r, p0, p1, p2);
+
+                if ((e[0] < 0 || e[1] < 0 || e[2] < 0) && (e[0] > 0 || e[1] > 0 || e[2] > 0)) return std::nullopt;
+                if (det == 0) return std::nullopt;
+                // t within (t_min, t_max], without dividing by det yet
+                if (det < 0 && (t_scaled >= t_min * det || t_scaled < t_max * det)) return std::nullopt;
+                if (det > 0 && (t_scaled <= t_min * det || t_scaled > t_max * det)) return std::nullopt;
+
+                auto t = t_scaled / det;
+
+                // Reject hits that rounding could have put in front of the origin (pbrt's bound on t).
+                auto max_of = [](Num a, Num b, Num c) { return std::max({ std::abs(a), std::abs(b), std::abs(c) }); };
+                auto max_x = max_of(p[0].x, p[1].x, p[2].x);
+                auto max_y = max_of(p[0].y, p[1].y, p[2].y);
+                auto max_z = max_of(p[0].z, p[1].z, p[2].z);
+                auto max_e = max_of(e[0], e[1], e[2]);
+                auto delta_z = common::gamma<Num>(3) * max_z;
+                auto delta_x = common::gamma<Num>(5) * (max_x + max_z);
+                auto delta_y = common::gamma<Num>(5) * (max_y + max_z);
+                auto delta_e = 2 * (common::gamma<Num>(2) * max_x * max_y + delta_y * max_x + delta_x * max_y);
+                auto delta_t = 3 * (common::gamma<Num>(3) * max_e * max_z + delta_e * max_z + delta_z * max_e) * std::abs(1 / det);
+                if (t <= delta_t) return std::nullopt;
+
+                return Query { t, 0, tri };
+            }
+    };
+}
@@ -4,8 +4,13 @@
 #include <stdexcept>
 #include <cmath>
 #include <iostream>
+#include <limits>
+#include <span>
+#include <utility>
+#include <concepts>
 
 #include "common.hpp"
+#include "simd.hpp"
 
 /*
 Notable changes from the book:
@@ -48,23 +53,30 @@ namespace vmath
     /* Classes */
 
     template<typename TActual, typename TNum>
-    struct Tup3Base
+    struct alignas(simd::alignment<TNum>) Tup3Base
     {
         using Num = TNum;
 
         Num x = 0;
         Num y = 0;
         Num z = 0;
+        [[no_unique_address]] simd::Pad<Num> _pad;
 
         /* no constructors to not interfere with tuple-ification */
 
-        constexpr auto operator-() const { return TActual {-x, -y, -z}; }
+        constexpr auto operator-() const
+        {
+            if constexpr (simd::Packed<TActual>) if !consteval {
+                return simd::store<TActual>(-simd::load(static_cast<TActual const&>(*this)));
+            }
+            return TActual {-x, -y, -z};
+        }
 
         /* prefer `std::get<i>(vec)` for compile time access */
 
         static constexpr auto size() { return 3; }
         // for runtime array access
-        constexpr auto operator[](int i)
+        constexpr auto operator[](int i) const
         {
             switch(i) {
                 case 0: return x;
@@ -77,16 +89,16 @@ namespace vmath
         constexpr auto operator+=(Tup3Affine auto vec)
         {
             x += get<0>(vec);
-            z += get<1>(vec);
-            y += get<2>(vec);
+            y += get<1>(vec);
+            z += get<2>(vec);
             return *this;
         }
         
         constexpr auto operator*=(TNum c)
         {
             x *= c;
-            z *= c;
             y *= c;
+            z *= c;
             return (*this);
         }
 
@@ -94,7 +106,14 @@ namespace vmath
             return *this *= 1/t;
         }
 
-        constexpr auto length_squared() const { return x*x + y*y + z*z; }
+        constexpr auto length_squared() const
+        {
+            if constexpr (simd::Packed<TActual>) if !consteval {
+                auto v = simd::load(static_cast<TActual const&>(*this));
+                return simd::sum3(v * v);
+            }
+            return x*x + y*y + z*z;
+        }
         constexpr auto length() const { return std::sqrt(length_squared()); }
     };
     template <unsigned I, typename TActual, typename TNum>
@@ -167,6 +186,11 @@ namespace vmath
     template<Tup3Like TN3A, Tup3Like TN3B>
     constexpr auto operator+(TN3A const& u, TN3B const& v)
     {
+        if constexpr (simd::Packed<TN3A> and simd::Packed<TN3B> and (IsAffine<TN3A> or IsAffine<TN3B>)) if !consteval {
+            using TN3 = std::conditional_t<IsAffine<TN3B>, TN3A, TN3B>;
+            return simd::store<TN3>(simd::load(u) + simd::load(v));
+        }
+
         if constexpr (IsAffine<TN3B>)
             return TN3A { u.x + v.x, u.y + v.y, u.z + v.z };
         else if constexpr (IsAffine<TN3A> and !IsAffine<TN3B>)
@@ -178,6 +202,12 @@ namespace vmath
     template<Tup3Like TN3A, Tup3Like TN3B>
     constexpr auto operator-(TN3A const& u, TN3B const& v)
     {
+        if constexpr (simd::Packed<TN3A> and simd::Packed<TN3B>) if !consteval {
+            using TN3 = std::conditional_t<IsAffine<TN3B>, TN3A,
+                std::conditional_t<IsAffine<TN3A>, TN3B, decltype(affine(u))>>;
+            return simd::store<TN3>(simd::load(u) - simd::load(v));
+        }
+
         if constexpr (IsAffine<TN3B>)
             return TN3A { u.x - v.x, u.y - v.y, u.z - v.z };
         else if constexpr (IsAffine<TN3A> and !IsAffine<TN3B>)
@@ -189,6 +219,9 @@ namespace vmath
     template<Tup3Affine TN3>
     constexpr auto operator*(typename TN3::Num t, TN3 const& v)
     {
+        if constexpr (simd::Packed<TN3>) if !consteval {
+            return simd::store<TN3>(simd::splat(t) * simd::load(v));
+        }
         return TN3 { t*v.x, t*v.y, t*v.z };
     }
 
@@ -207,6 +240,9 @@ namespace vmath
     template<Tup3Affine TN3>
     constexpr auto dot(TN3 const& u, TN3 const& v)
     {
+        if constexpr (simd::Packed<TN3>) if !consteval {
+            return simd::sum3(simd::load(u) * simd::load(v));
+        }
         auto [ux, uy, uz] = u; auto [vx, vy, vz] = v;
         return ux * vx + uy * vy + uz * vz;
     }
@@ -214,6 +250,10 @@ namespace vmath
     template<Tup3Affine TN3>
     constexpr auto cross(TN3 const& u, TN3 const& v)
     {
+        if constexpr (simd::Packed<TN3>) if !consteval {
+            auto a = simd::load(u), b = simd::load(v);
+            return simd::store<TN3>(simd::rotate3(a * simd::rotate3(b) - simd::rotate3(a) * b));
+        }
         auto [ux, uy, uz] = u; auto [vx, vy, vz] = v;
         return TN3 {
             uy * vz - uz * vy,
@@ -239,39 +279,242 @@ namespace vmath
         return r_out_perp + r_out_parallel;
     }
 
+    // Two unit vectors completing `n` to an orthonormal basis (Duff et al. 2017, branchless).
+    template<Tup3Affine TN3>
+    constexpr auto orthonormal_basis(TN3 const& n)
+    {
+        using Num = typename TN3::Num;
+
+        auto sign = std::copysign(Num(1), n.z);
+        auto a = Num(-1) / (sign + n.z);
+        auto b = n.x * n.y * a;
+        return std::pair {
+            TN3 { 1 + sign * n.x * n.x * a, sign * b, -sign * n.x },
+            TN3 { b, sign + n.y * n.y * a, -n.y }
+        };
+    }
+
+    // `local` expressed in the frame where `n` is the z axis.
+    template<Tup3Affine TN3>
+    constexpr auto from_local(TN3 const& local, TN3 const& n)
+    {
+        auto [t, b] = orthonormal_basis(n);
+        return local.x * t + local.y * b + local.z * n;
+    }
+
+    constexpr auto abs(Tup3Like auto const& v) { return map(v, [](auto n) { return std::abs(n); }); }
+
+    // Moves `p` off the surface along `n` by more than its error bound, to the side `w` leaves towards,
+    // so a ray spawned there can not re-intersect the surface it starts on.
+    template<Tup3NonAffine TN3, Tup3Affine TVec>
+    constexpr auto offset_ray_origin(TN3 const& p, TVec const& p_error, TVec const& n, TVec const& w)
+    {
+        using Num = typename TN3::Num;
+
+        auto d = dot(abs(n), p_error);
+        auto offset = d * n;
+        if (dot(w, n) < 0)
+            offset = -offset;
+
+        // Round away from p, the addition may have rounded back towards it.
+        constexpr auto inf = std::numeric_limits<Num>::infinity();
+        auto round_away = [](Num v, Num o) {
+            return o > 0 ? std::nextafter(v, inf) : o < 0 ? std::nextafter(v, -inf) : v;
+        };
+
+        auto po = p + offset;
+        return TN3 { round_away(po.x, offset.x), round_away(po.y, offset.y), round_away(po.z, offset.z) };
+    }
+
+    /*
+    Closed form mappings from the unit square, no rejection loops:
+        - Branch free apart from selects, and only call `sqrt`, so loops over them vectorize
+        - Built on the concentric disk, which keeps strata of the square compact
+        - The `_n` forms map whole batches, structure of arrays in and out
+    */
+
+    // sin and cos for |a| <= pi/4, as polynomials so they vectorize where libm calls would not.
+    template<std::floating_point TNum>
+    constexpr auto sincos_quarter(TNum a) -> std::pair<TNum, TNum>
+    {
+        auto a2 = a * a;
+        auto s = a * (1 + a2 * (TNum(-1./6) + a2 * (TNum(1./120) + a2 * (TNum(-1./5040) + a2 * (TNum(1./362880) + a2 * TNum(-1./39916800))))));
+        auto c = 1 + a2 * (TNum(-1./2) + a2 * (TNum(1./24) + a2 * (TNum(-1./720) + a2 * (TNum(1./40320) + a2 * (TNum(-1./3628800) + a2 * TNum(1./479001600))))));
+        return { s, c };
+    }
+
+    // Unit square onto the unit disk (Shirley-Chiu), area preserving.
     template<Tup3Like TN3>
-    constexpr auto rand_in_sphere(common::RandomState& rs) {
+    constexpr auto concentric_disk(typename TN3::Num u1, typename TN3::Num u2)
+    {
+        using Num = typename TN3::Num;
+
+        auto x = 2 * u1 - 1, y = 2 * u2 - 1;
+        // the angle is pi/4 times the ratio of the minor to the major coordinate,
+        // measured from the x axis when x is major and from the y axis otherwise
+        bool x_major = std::abs(x) > std::abs(y);
+        auto r = x_major ? x : y;
+        auto ratio = (x_major ? y : x) / (r == 0 ? Num(1) : r);
+        auto [s, c] = sincos_quarter(Num(common::pi / 4) * ratio);
+        return TN3 { r * (x_major ? c : s), r * (x_major ? s : c), 0 };
+    }
+
+    // Uniform over the hemisphere around +z, by lifting the disk with an equal area map.
+    template<Tup3Like TN3>
+    constexpr auto uniform_hemisphere(typename TN3::Num u1, typename TN3::Num u2)
+    {
+        using Num = typename TN3::Num;
+
+        auto d = concentric_disk<TN3>(u1, u2);
+        auto r2 = d.x * d.x + d.y * d.y;
+        auto s = std::sqrt(std::max(Num(0), 2 - r2));
+        return TN3 { d.x * s, d.y * s, 1 - r2 };
+    }
+
+    // Cosine weighted around +z, the disk projected straight up (Malley's method).
+    template<Tup3Like TN3>
+    constexpr auto cosine_hemisphere(typename TN3::Num u1, typename TN3::Num u2)
+    {
         using Num = typename TN3::Num;
-        while (true) {
-            auto p = rand<TN3>(rs, Num(-1), Num(1));
-            if (p.length_squared() >= 1) continue;
-            return p;
+
+        auto d = concentric_disk<TN3>(u1, u2);
+        return TN3 { d.x, d.y, std::sqrt(std::max(Num(0), 1 - d.x * d.x - d.y * d.y)) };
+    }
+
+    // Uniform over the sphere, `u1` picks the hemisphere and is reused within it.
+    template<Tup3Like TN3>
+    constexpr auto uniform_sphere(typename TN3::Num u1, typename TN3::Num u2)
+    {
+        bool lower = u1 >= typename TN3::Num(0.5);
+        auto h = uniform_hemisphere<TN3>(2 * u1 - (lower ? 1 : 0), u2);
+        return TN3 { h.x, h.y, lower ? -h.z : h.z };
+    }
+
+    template<Tup3Like TN3>
+    constexpr auto uniform_ball(typename TN3::Num u1, typename TN3::Num u2, typename TN3::Num u3)
+    {
+        return std::cbrt(u3) * uniform_sphere<TN3>(u1, u2);
+    }
+
+    // Structure of arrays batch of 3-tuples.
+    template<std::floating_point TNum>
+    struct Batch3
+    {
+        std::span<TNum> x, y, z;
+
+        constexpr auto size() const { return x.size(); }
+    };
+
+    // Applies a unit square mapping to every (u1[i], u2[i]). The batch forms take their
+    // number type from `TN3` rather than the spans, so spans of mutable numbers fit.
+    template<Tup3Like TN3, typename TNum = typename TN3::Num>
+    constexpr void map_square_n(auto const& mapping, std::span<typename TN3::Num const> u1, std::span<typename TN3::Num const> u2, Batch3<typename TN3::Num> out)
+    {
+        auto const n = out.size();
+        for (size_t i = 0; i < n; ++i)
+        {
+            auto p = mapping(u1[i], u2[i]);
+            out.x[i] = p.x;
+            out.y[i] = p.y;
+            out.z[i] = p.z;
         }
     }
 
+    template<Tup3Like TN3, typename TNum = typename TN3::Num>
+    constexpr void concentric_disk_n(std::span<typename TN3::Num const> u1, std::span<typename TN3::Num const> u2, Batch3<typename TN3::Num> out)
+    {
+        map_square_n<TN3>([](TNum a, TNum b) { return concentric_disk<TN3>(a, b); }, u1, u2, out);
+    }
+
+    template<Tup3Like TN3, typename TNum = typename TN3::Num>
+    constexpr void uniform_hemisphere_n(std::span<typename TN3::Num const> u1, std::span<typename TN3::Num const> u2, Batch3<typename TN3::Num> out)
+    {
+        map_square_n<TN3>([](TNum a, TNum b) { return uniform_hemisphere<TN3>(a, b); }, u1, u2, out);
+    }
+
+    template<Tup3Like TN3, typename TNum = typename TN3::Num>
+    constexpr void cosine_hemisphere_n(std::span<typename TN3::Num const> u1, std::span<typename TN3::Num const> u2, Batch3<typename TN3::Num> out)
+    {
+        map_square_n<TN3>([](TNum a, TNum b) { return cosine_hemisphere<TN3>(a, b); }, u1, u2, out);
+    }
+
+    template<Tup3Like TN3, typename TNum = typename TN3::Num>
+    constexpr void uniform_sphere_n(std::span<typename TN3::Num const> u1, std::span<typename TN3::Num const> u2, Batch3<typename TN3::Num> out)
+    {
+        map_square_n<TN3>([](TNum a, TNum b) { return uniform_sphere<TN3>(a, b); }, u1, u2, out);
+    }
+
+    // Random state versions of the mappings above.
+
+    template<Tup3Like TN3>
+    constexpr auto rand_in_sphere(common::RandomState& rs) {
+        using Num = typename TN3::Num;
+        return uniform_ball<TN3>(rand<Num>(rs), rand<Num>(rs), rand<Num>(rs));
+    }
+
     template<Tup3Like TN3>
     constexpr auto rand_in_disk(common::RandomState& rs) {
         using Num = typename TN3::Num;
-        while (true) {
-            auto p = TN3 { rand<Num>(rs, -1, 1), rand<Num>(rs, -1, 1), 0 };
-            if (p.length_squared() >= 1) continue;
-            return p;
-        }
+        return concentric_disk<TN3>(rand<Num>(rs), rand<Num>(rs));
     }
 
     template<Tup3Like TN3>
     constexpr auto rand_unit_vector(common::RandomState& rs) {
-        return unit_vector(rand_in_sphere<TN3>(rs));
+        using Num = typename TN3::Num;
+        return uniform_sphere<TN3>(rand<Num>(rs), rand<Num>(rs));
     }
 
-    template<Tup3Like TN3>
+    template<Tup3Affine TN3>
     constexpr auto rand_in_hemisphere(TN3 const& normal, common::RandomState& rs) {
-        auto in_sphere = rand_in_sphere<TN3>(rs);
-        if (dot(in_sphere, normal) > 0.0) // In the same hemisphere as the normal
-            return in_sphere;
-        else
-            return -in_sphere;
+        using Num = typename TN3::Num;
+        return from_local(uniform_hemisphere<TN3>(rand<Num>(rs), rand<Num>(rs)), normal);
     }
+
+    // A sampled direction and the solid angle density it was drawn with.
+    template<Tup3Affine TN3>
+    struct DirectionSample
+    {
+        TN3 direction;
+        typename TN3::Num pdf;
+    };
+
+    /*
+    Hemisphere samplers around a unit normal:
+        - `sample` maps a point of the unit square to a unit direction
+        - `pdf` is the density `sample` would have drawn `wi` with
+    */
+    template<Tup3Affine TN3>
+    struct CosineHemisphere
+    {
+        using Num = typename TN3::Num;
+
+        static constexpr auto sample(TN3 const& normal, Num u1, Num u2) -> DirectionSample<TN3>
+        {
+            auto local = cosine_hemisphere<TN3>(u1, u2);
+            return { from_local(local, normal), local.z / Num(common::pi) };
+        }
+
+        static constexpr auto pdf(TN3 const& normal, TN3 const& wi) -> Num
+        {
+            return std::max(Num(0), dot(normal, wi)) / Num(common::pi);
+        }
+    };
+
+    template<Tup3Affine TN3>
+    struct UniformHemisphere
+    {
+        using Num = typename TN3::Num;
+
+        static constexpr auto sample(TN3 const& normal, Num u1, Num u2) -> DirectionSample<TN3>
+        {
+            return { from_local(uniform_hemisphere<TN3>(u1, u2), normal), Num(1 / (2 * common::pi)) };
+        }
+
+        static constexpr auto pdf(TN3 const& normal, TN3 const& wi) -> Num
+        {
+            return dot(normal, wi) > 0 ? Num(1 / (2 * common::pi)) : Num(0);
+        }
+    };
 }
 
 template <typename TNum>
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <bit>
+#include <span>
+#include <array>
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <algorithm>
+#include <stdexcept>
+
+#include "owrt.hpp"
+
+#include "bvh.hpp"
+#include "bounds.hpp"
+
+/*
+Compressed 8 wide BVH (after Ylitie et al. 2017):
+    - Built by collapsing a binary `Bvh`: every node takes the children of its largest
+      interior children until it has eight, so about three binary levels become one
+    - Child boxes are stored as 8 bit offsets on a grid laid over the node's own box,
+      whose cell size along each axis is a power of two kept as its exponent; they are
+      rounded outwards, so a child's box only ever grows
+    - A node tests all eight child boxes at once with the GCC vector extensions, `-march`
+      picking the width, and visits the hit ones nearest first
+    - Leaves stay the binary tree's leaves, runs of `order` as there
+*/
+namespace bvh
+{
+    template<std::floating_point TNum>
+    class WideBvh
+    {
+        public:
+            using Num = TNum;
+            using Bounds = vmath::Bounds3<Num>;
+            using Settings = bvh::Settings;
+
+            static constexpr int width = 8;
+            static constexpr int levels = 255;  // the largest quantised offset
+
+            struct Node
+            {
+                std::array<Num, 3> origin {};       // low corner of the grid, the node's box
+                std::array<int8_t, 3> exponent {};  // a grid cell is 2^exponent along each axis
+                uint8_t children = 0;               // slots in use, always the first ones
+                std::array<std::array<uint8_t, width>, 3> lo {}, hi {};  // per axis, per child, in cells
+                std::array<uint32_t, width> index {};   // a child node, or a leaf's first entry of `order`
+                std::array<uint8_t, width> count {};    // primitives of a leaf child, zero for a node
+            };
+
+        private:
+            std::vector<Node> _nodes;
+            std::vector<uint32_t> _order;
+            Bounds _bounds;
+
+            template<typename T>
+            using Lanes [[gnu::vector_size(width * sizeof(T))]] = T;
+            using Bytes [[gnu::vector_size(width)]] = uint8_t;
+
+        public:
+            WideBvh() = default;
+
+            explicit WideBvh(std::span<Bounds const> prims, Settings const& settings = {})
+            {
+                if (std::max(settings.max_leaf, settings.max_sah_leaf) > UINT8_MAX)
+                    throw std::invalid_argument("wide bvh leaves hold at most 255 primitives");
+
+                Bvh<Num> binary { prims, settings };
+                if (binary.nodes().empty()) return;
+
+                _bounds = binary.bounds();
+                _order.assign(binary.order().begin(), binary.order().end());
+                _nodes.reserve(binary.nodes().size() / 4 + 1);
+                collapse(binary.nodes(), 0);
+            }
+
+            auto nodes() const -> std::span<Node const> { return _nodes; }
+            auto order() const -> std::span<uint32_t const> { return _order; }
+            auto bounds() const -> Bounds { return _bounds; }
+            auto bytes() const -> size_t { return _nodes.size() * sizeof(Node) + _order.size() * sizeof(uint32_t); }
+
+            // Closest hit along `seg`, `test(prim, seg)` returning an optional with a `t` member.
+            auto intersect(vmath::RaySegLike auto seg, auto&& test) const -> decltype(test(uint32_t(), seg))
+            {
+                decltype(test(uint32_t(), seg)) closest;
+                traverse(seg, [&](uint32_t prim, auto& s) {
+                    if (auto q = test(prim, s)) {
+                        closest = q;
+                        s.t_max = q->t;
+                    }
+                    return false;
+                });
+                return closest;
+            }
+
+            // Whether `test(prim, seg)` holds for any primitive, stopping at the first.
+            auto occluded(vmath::RaySegLike auto seg, auto&& test) const -> bool
+            {
+                return traverse(seg, [&](uint32_t prim, auto const& s) { return bool(test(prim, s)); });
+            }
+
+        private:
+            // 2^e, built straight from its bits.
+            static auto cell(int8_t e) -> Num
+            {
+                if constexpr (sizeof(Num) == 4) return std::bit_cast<Num>(uint32_t(e + 127) << 23);
+                else return std::bit_cast<Num>(uint64_t(e + 1023) << 52);
+            }
+
+            // Builds the wide node over binary `node`, returning its index.
+            auto collapse(std::span<typename Bvh<Num>::Node const> binary, uint32_t node) -> uint32_t
+            {
+                auto wide = uint32_t(_nodes.size());
+                _nodes.emplace_back();
+
+                // open the largest interior child until the slots are full or only leaves are left
+                std::array<uint32_t, width> slots { node };
+                int used = 1;
+                while (used < width)
+                {
+                    int open = -1;
+                    for (int i = 0; i < used; ++i)
+                        if (binary[slots[i]].count == 0
+                            && (open < 0 || binary[slots[i]].bounds.surface_area() > binary[slots[open]].bounds.surface_area()))
+                            open = i;
+                    if (open < 0) break;
+
+                    auto parent = slots[open];
+                    slots[open] = parent + 1;
+                    slots[used++] = binary[parent].index;
+                }
+
+                auto const& box = binary[node].bounds;
+                Node n;
+                n.children = uint8_t(used);
+                for (int a = 0; a < 3; ++a)
+                {
+                    n.origin[a] = box.lo[a];
+                    auto extent = box.hi[a] - box.lo[a];
+                    int e = extent > 0 ? std::ilogb(extent / levels) + 1 : -126;
+                    e = std::clamp(e, -126, 127);
+                    while (e < 127 && n.origin[a] + levels * cell(int8_t(e)) < box.hi[a]) ++e;
+                    n.exponent[a] = int8_t(e);
+
+                    // Offsets are decoded as `origin + q * cell` in traversal, so each is
+                    // checked against that and moved out a cell if rounding put it inside.
+                    auto size = cell(n.exponent[a]);
+                    auto decode = [&](int q) { return n.origin[a] + Num(q) * size; };
+                    for (int i = 0; i < used; ++i)
+                    {
+                        auto const& child = binary[slots[i]].bounds;
+                        auto lo = int(std::clamp(std::floor((child.lo[a] - n.origin[a]) / size), Num(0), Num(levels)));
+                        auto hi = int(std::clamp(std::ceil((child.hi[a] - n.origin[a]) / size), Num(0), Num(levels)));
+                        while (lo > 0 && decode(lo) > child.lo[a]) --lo;
+                        while (hi < levels && decode(hi) < child.hi[a]) ++hi;
+                        n.lo[a][i] = uint8_t(lo);
+                        n.hi[a][i] = uint8_t(hi);
+                    }
+                }
+                // unused slots get an inverted box, missed by every ray
+                for (int i = used; i < width; ++i)
+                    for (int a = 0; a < 3; ++a) {
+                        n.lo[a][i] = levels;
+                        n.hi[a][i] = 0;
+                    }
+
+                for (int i = 0; i < used; ++i)
+                {
+                    auto const& child = binary[slots[i]];
+                    n.count[i] = uint8_t(child.count);
+                    n.index[i] = child.count > 0 ? child.index : collapse(binary, slots[i]);
+                }
+                _nodes[wide] = n;
+                return wide;
+            }
+
+            // `visit(prim, seg)` sees candidates nearest box first and may shrink `seg.t_max`,
+            // returning true ends the traversal.
+            auto traverse(auto seg, auto&& visit) const -> bool
+            {
+                if (_nodes.empty()) return false;
+
+                using RNum = typename decltype(seg)::Num;
+                using RLanes = Lanes<RNum>;
+                auto const& r = seg.ray;
+                vmath::Vec3<RNum> inv { 1 / r.direction.x, 1 / r.direction.y, 1 / r.direction.z };
+                std::array<bool, 3> negative { inv.x < 0, inv.y < 0, inv.z < 0 };
+                auto const widen = 1 + 2 * common::gamma<RNum>(3);
+
+                auto offsets = [](std::array<uint8_t, width> const& q) {
+                    Bytes b;
+                    std::memcpy(&b, q.data(), sizeof(b));
+                    return __builtin_convertvector(b, RLanes);
+                };
+
+                // Slabs of all eight child boxes, the far distances widened as in `Bvh`.
+                // Returns the children hit and their entry distances.
+                auto crosses = [&](Node const& n, RLanes& entry) -> unsigned {
+                    RLanes t0 = RLanes {} + seg.t_min, t1 = RLanes {} + seg.t_max;
+                    for (int a = 0; a < 3; ++a) {
+                        auto size = RNum(cell(n.exponent[a]));
+                        auto lo = RNum(n.origin[a]) + offsets(n.lo[a]) * size;
+                        auto hi = RNum(n.origin[a]) + offsets(n.hi[a]) * size;
+                        auto near = ((negative[a] ? hi : lo) - r.origin[a]) * inv[a];
+                        auto far = ((negative[a] ? lo : hi) - r.origin[a]) * inv[a] * widen;
+                        t0 = near > t0 ? near : t0;
+                        t1 = far < t1 ? far : t1;
+                    }
+                    entry = t0;
+                    auto crossed = t0 <= t1;
+                    unsigned mask = 0;
+                    for (int i = 0; i < width; ++i) mask |= unsigned(crossed[i] != 0) << i;
+                    return mask & ((1u << n.children) - 1);
+                };
+
+                struct Entry
+                {
+                    RNum t;             // where the ray enters the box
+                    uint32_t index;
+                    uint8_t count;      // as in `Node`
+                };
+                // every level leaves at most seven siblings behind
+                std::array<Entry, 512> stack;
+                size_t top = 0;
+                stack[top++] = { seg.t_min, 0, 0 };
+
+                while (top > 0)
+                {
+                    auto e = stack[--top];
+                    if (e.t > seg.t_max) continue;
+
+                    if (e.count > 0) {
+                        for (auto i = e.index; i < e.index + e.count; ++i)
+                            if (visit(_order[i], seg)) return true;
+                        continue;
+                    }
+
+                    auto const& n = _nodes[e.index];
+                    RLanes entry;
+                    auto mask = crosses(n, entry);
+
+                    // pushed farthest first, so the nearest is taken next
+                    std::array<Entry, width> hits;
+                    int k = 0;
+                    for (; mask; mask &= mask - 1) {
+                        auto i = std::countr_zero(mask);
+                        Entry h { entry[i], n.index[i], n.count[i] };
+                        int j = k++;
+                        for (; j > 0 && hits[j - 1].t < h.t; --j) hits[j] = hits[j - 1];
+                        hits[j] = h;
+                    }
+                    for (int i = 0; i < k; ++i) stack[top++] = hits[i];
+                }
+                return false;
+            }
+    };
+}
+
+namespace object
+{
+    // A `HittableList` that finds hits through a `bvh::WideBvh`.
+    template<WorldLike TWorld>
+    using WideBvhList = AcceleratedList<TWorld, bvh::WideBvh<typename TWorld::Num>>;
+}